@@ -0,0 +1,109 @@
+#pragma once
+
+#include "types.hpp"
+#include <cstddef>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+class HttpRequest;
+
+// access logの1行ぶんの値; HttpTransactionがrequestの終わりに埋める
+struct AccessLogRecord {
+  const HttpRequest *request;
+  int client_fd;
+  int status;                      // 応答を積む前にclientが切断したら 499
+  size_t bytes_sent;               // 積んだ応答 + spliceで送ったCGIのbody
+  unsigned long long request_usec; // 最初のbyteから応答を積み終えるまで
+};
+
+/*
+AccessLog: server blockの `access_log <path> [text|json];` に1requestを1行で書く
+- 書式は `log_format $remote_addr "$request" $status ...;` (nginxと同じ変数名)
+  json指定では、log_formatの変数名をkeyにしたobjectを1行に書く
+- 行はpathごとのbufferに溜め、k_flush_bytes を超えるか
+  k_flush_interval_sec 経ったら (handle_timeouts) まとめて1回のwriteで書く
+- 書式は起動時に変数の列へ変換しておき、requestごとには解析しない
+*/
+class AccessLog {
+public:
+  static AccessLog &get_instance() {
+    if (!instance_) {
+      create_instance();
+    }
+    return *instance_;
+  }
+  static void delete_instance();
+
+  // access_log / log_format の書き方を確かめる (Parseから); 不正ならthrow
+  static void validate(const ConfigMap &config);
+  void open(const ServerAndLocationConfigs &configs); // 不正な設定はthrow
+  bool is_enabled() const { return !sinks_.empty(); }
+
+  void write(const AccessLogRecord &record);
+  void flush_if_due(time_t now);
+  void flush();
+
+private:
+  enum Field {
+    FIELD_LITERAL,
+    FIELD_REMOTE_ADDR,
+    FIELD_TIME_LOCAL,
+    FIELD_TIME_ISO8601,
+    FIELD_REQUEST,
+    FIELD_REQUEST_METHOD,
+    FIELD_REQUEST_URI,
+    FIELD_SERVER_PROTOCOL,
+    FIELD_STATUS,
+    FIELD_BYTES_SENT,
+    FIELD_REQUEST_TIME,
+    FIELD_HOST,
+    FIELD_HTTP_REFERER,
+    FIELD_HTTP_USER_AGENT
+  };
+  struct Token {
+    Field field;
+    std::string text; // literalの文字列, または変数名 (jsonのkey)
+  };
+  struct Sink {
+    int fd;
+    bool json;
+    std::string format; // 設定の書式 (同じpathで書式が食い違わないかの確認用)
+    std::vector<Token> tokens;
+    std::string buffer;
+  };
+
+  static AccessLog *instance_;
+  static const size_t k_flush_bytes = 32768;
+  static const size_t k_max_buffer_bytes = 1048576; // 書けない間に溜める上限
+  static const time_t k_flush_interval_sec = 1;
+
+  std::map<std::string, Sink> sinks_; // access_logのpathごと
+  time_t last_flush_;
+  time_t cached_time_; // time_local_, time_iso8601_ を作った時刻
+  std::string time_local_;
+  std::string time_iso8601_;
+  size_t dropped_lines_;
+
+  static void create_instance();
+
+  static bool parse_directive(const ConfigMap &config, std::string &path,
+                              bool &json, std::string &format);
+  void open_sink(const ConfigMap &config);
+  static void compile_format(const std::string &format,
+                             std::vector<Token> &tokens);
+  void update_time_cache();
+  void append_text(std::string &out, const std::vector<Token> &tokens,
+                   const AccessLogRecord &record);
+  void append_json(std::string &out, const std::vector<Token> &tokens,
+                   const AccessLogRecord &record);
+  void append_field(std::string &out, Field field,
+                    const AccessLogRecord &record, bool json);
+  void flush_sink(const std::string &path, Sink &sink);
+
+  AccessLog();
+  ~AccessLog();
+  AccessLog(const AccessLog &other);
+  AccessLog &operator=(const AccessLog &other);
+};
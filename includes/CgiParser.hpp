@@ -17,13 +17,20 @@ public:
 
   // ==== Public API ====
   void append(const char *data, size_t length);
+  void append(std::vector<char> &data);
   bool parse(bool eof);
+  void clear(); // 再利用のため初期状態に戻す (bufferの容量は残す)
   bool is_done() const;
+  bool has_error() const; // 不正な出力 (headerの途中でEOF等)
+  bool is_streaming() const;
+  size_t buffered_size() const;
+  bool is_passthrough() const;
+  size_t get_remaining_body() const;
+  void consume_relayed(size_t length);
 
   int get_status_code() const;
-  const std::vector<std::pair<std::string, std::string> > &
-  get_parsed_headers() const;
-  std::vector<char> take_body();
+  void take_headers(std::vector<std::pair<std::string, std::string> > &out);
+  void take_body(std::vector<char> &out);
 
 private:
   enum CgiParseState {
@@ -45,6 +52,7 @@ private:
   std::vector<std::pair<std::string, std::string> > headers_;
   std::vector<char> body_;
   size_t body_size_;
+  size_t body_received_; // Content-Length のうち body_ に移した累計
 
   // ==== Main parse logic ====
   void parse_headers();
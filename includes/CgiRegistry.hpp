@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <map>
 #include <set>
+#include <sys/types.h>
 #include <vector>
 
 class CgiSession;
@@ -16,6 +17,8 @@ public:
   void remove(int fd);
   CgiSession *get(int fd) const;
   bool has(int fd) const;
+  CgiSession *find_by_pid(pid_t pid) const;
+  size_t get_session_count() const; // stdin / stdout の2fdで1つと数える
 
   std::set<int> mark_timed_outs();
 
@@ -18,12 +18,14 @@ public:
   ~CgiResponseBuilder();
 
   void apply(CgiParser &parser);
+  void clear(); // 再利用のため初期状態に戻す (bufferの容量は残す)
   void set_connection_policy(ConnectionPolicy policy);
-  void build_response(HttpResponse &response, bool eof);
+  void build_response(HttpResponse &response, bool done);
   void build_error_response(HttpResponse &response, int status_code);
   void build_error_response(HttpResponse &response, int status_code,
                             ConnectionPolicy policy);
   bool is_sent() const;
+  bool is_header_sent() const;
 
 private:
   int status_code_;
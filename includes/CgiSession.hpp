@@ -2,6 +2,7 @@
 
 #include "CgiParser.hpp"
 #include "CgiResponseBuilder.hpp"
+#include "FastCgiUtils.hpp"
 #include "HttpRequest.hpp"
 #include "Logger.hpp"
 #include "ResponseTypes.hpp"
@@ -9,6 +10,7 @@
 #include <fcntl.h>
 #include <iostream>
 #include <string>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -19,6 +21,7 @@ enum CgiIOStatus {
   CGI_IO_READY_TO_WRITE, // write監視をON
   CGI_IO_WRITE_COMPLETE, // write監視をOFF
   CGI_IO_READ_COMPLETE,
+  CGI_IO_RELAYED,         // spliceでclient socketへ直接送信済み
   CGI_IO_SHOULD_SHUTDOWN, // shutdown(fd, SHUT_WR)
   CGI_IO_SHOULD_CLOSE,    // close(fd)
   CGI_IO_ERROR
@@ -48,13 +51,21 @@ public:
   };
 
   // Constructor / Destructor / Assignment
-  CgiSession(int client_fd);
+  explicit CgiSession(int client_fd = -1); // -1: pool待機用
   ~CgiSession();
 
+  // ObjectPool<CgiSession> 経由で生成・返却する
+  static CgiSession *create(int client_fd);
+  static void release(CgiSession *session);
+  void recycle();
+  bool is_idle() const;
+
   // Accessors
   int get_client_fd() const { return client_fd_; };
+  pid_t get_pid() const { return pid_; };
   int get_stdin_fd() const;
   int get_stdout_fd() const;
+  size_t get_relayed_bytes() const { return relayed_bytes_; }
   void mark_client_dead();
 
   // State checkers
@@ -67,16 +78,22 @@ public:
 
   // Main processing logic
   void handle_cgi_request(HttpRequest &request, const std::string &cgi_path);
+  void handle_fastcgi_request(HttpRequest &request, const std::string &address,
+                              const std::string &script_path);
   void build_response(HttpResponse &response);
   void build_error_response(HttpResponse &response, int status_code,
                             ConnectionPolicy policy);
 
   void close_fd(int fd);
+  void update_read_throttle(size_t queued_bytes);
 
   // event 発火
   CgiIOStatus on_cgi_write(); // write body to CGI
   CgiIOStatus on_cgi_read();  // read output from CGI
   void on_cgi_timeout();
+  bool on_cgi_exit(int status);
+  // 終了statusをlogに出す; started_at がNULLなら所要時間は省く
+  static void log_exit(pid_t pid, int status, const struct timeval *started_at);
 
 private:
   CgiParser parser_;
@@ -92,12 +109,28 @@ private:
   size_t in_off_;            // 入力進捗のoffset
 
   time_t cgi_last_activity_; // timeout監視用タイムスタンプ
+  struct timeval started_at_; // 子processの起動時刻 (終了時に所要時間を出す)
   bool client_alive_; // Clientが死んだ時に、CgiSessionのself clean upを喚起
+  bool read_paused_;  // Client送信待ちが溜まり、stdoutの監視を外している
+  size_t client_queued_bytes_; // Clientのresponse queueに残るバイト数
+  bool splice_enabled_;        // splice不可と判明したらreadにfallback
+  size_t relayed_bytes_;       // spliceでclientへ直接送ったバイト数
+
+  // FastCGI: stdin_fd_ と stdout_fd_ は同じ socket を指す
+  bool is_fastcgi_;
+  std::string fastcgi_address_;
+  FastCgiRecordParser record_parser_;
 
   // Helpers
+  void start_pipe_io();
+  void kill_child();
   void terminate_pid();
   void terminate_cgi_fds();
   bool is_terminal_state() const;
+  bool can_splice() const;
+  CgiIOStatus relay_by_splice();
+  CgiIOStatus on_fastcgi_read(const char *data, size_t length);
+  bool drain_stdout();
 
   void update_cgi_activity();
 
@@ -2,8 +2,11 @@
 
 #include "types.hpp"
 #include <string>
+#include <utility>
 #include <vector>
 
+class HttpRequest;
+
 namespace CgiUtils {
 
 bool is_cgi_request(const std::string &path,
@@ -11,5 +14,11 @@ bool is_cgi_request(const std::string &path,
 
 bool is_location_has_cgi(ConfigMap best_match_config);
 bool is_cgi_like_path(const std::string& path);
+bool is_location_has_fastcgi(const ConfigMap &best_match_config);
+
+std::vector<std::pair<std::string, std::string> >
+build_cgi_params(const HttpRequest &request, const std::string &script_path);
+std::vector<std::string> build_cgi_env(const HttpRequest &request,
+                                       const std::string &script_path);
 
 } // namespace CgiUtils
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <sys/types.h>
+
+/*
+ChildReaper: 子processの終了を、Multiplexerで監視できるfdのeventに変換する
+- Linux: SIGCHLDをblockし、signalfdで受け取る
+- その他: SIGCHLD handlerは self-pipe に1byte書くだけ
+- waitpidはevent loopの中で行い、終了statusをCgiSessionに渡す
+*/
+class ChildReaper {
+public:
+  ChildReaper();
+  ~ChildReaper();
+
+  void open();
+  int get_fd() const;
+
+  void drain();
+  bool reap(pid_t &pid, int &status);
+
+private:
+  int fd_;       // 監視するfd (signalfd or self-pipeの読み込み側)
+  int write_fd_; // self-pipeの書き込み側; signalfdでは未使用
+
+  ChildReaper(const ChildReaper &other);
+  ChildReaper &operator=(const ChildReaper &other);
+};
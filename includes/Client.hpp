@@ -1,6 +1,7 @@
 #pragma once
 
 #include "HttpTransaction.hpp"
+#include "SocketBuilder.hpp"
 #include <ctime>
 #include <string>
 
@@ -22,14 +23,29 @@ Client: ソケットの管理、TCP接続の状態管理、Time-out処理
 */
 class Client {
 public:
-  Client(int clientfd, const VirtualHostRouter *router);
+  Client(int clientfd, const VirtualHostRouter *router,
+         const ListenOptions &options);
+  Client(); // pool待機用
   ~Client();
 
+  // ObjectPool<Client> 経由で生成・返却する
+  static Client *create(int clientfd, const VirtualHostRouter *router,
+                        const ListenOptions &options);
+  static void release(Client *client);
+  void recycle();
+  bool is_idle() const;
+
   int get_fd() const;
+  const std::string &get_request_line() const;
+  // 前回のwritevで送りきれず、書き込み可能の通知を待っている
+  bool is_awaiting_writable() const;
 
-  IOStatus on_read();
+  IOStatus on_read(); // receive() + process_received()
+  IOStatus receive();
+  IOStatus process_received();
   IOStatus on_write();
   IOStatus on_timeout();
+  void on_cgi_relay();
 
   bool is_timeout(time_t now) const;
   bool is_unresponsive(time_t now) const;
@@ -40,9 +56,18 @@ private:
   time_t timeout_sec_;
   time_t last_activity_;
 
+  bool tcp_nodelay_; // listenの nodelay=
+  bool tcp_cork_;    // listenの cork=
+  bool nodelay_set_; // TCP_NODELAY 設定済み
+  bool corked_;      // TCP_CORK 中
+  bool awaiting_writable_; // 送りきれなかった応答が残っている
+
   HttpTransaction transaction_;
 
   void update_activity();
+  void close_fd();
+  void enable_nodelay();
+  void set_cork(bool on);
 
   Client(const Client &other);
   Client &operator=(const Client &other);
@@ -16,6 +16,7 @@ public:
   void remove(int fd);
   Client *get(int fd) const;
   bool has(int fd) const;
+  size_t get_client_count() const;
 
   std::vector<int> mark_timed_out_clients();
   std::vector<int> detect_unresponsive_clients() const;
@@ -14,6 +14,7 @@
 
 #include "Utils.hpp"
 #include "types.hpp"
+#include <set>
 
 class Parse{
     private:
@@ -24,6 +25,13 @@ class Parse{
         std::vector<std::map<std::string, std::vector<std::string> > > server_configs;
         std::vector<std::map<std::string, std::map<std::string, std::vector<std::string> > > > locations_configs;
         std::map<ListenPair, std::vector<std::string> > listen_to_names;
+        // backlog= などのsocketのparameterを指定済みのip:port (nginxと同じく1つのserverだけ)
+        std::set<ListenPair> listens_with_options;
+        // events { use epoll; } で指定したI/O多重化の実装; 空なら既定
+        std::string event_backend;
+        // events { stall_threshold_ms 100; } ; -1なら未指定 (Multiplexerの既定)
+        int stall_threshold_ms;
+        bool in_events_block;
 
     public:
 
@@ -38,18 +46,25 @@ class Parse{
         void validate_config_keys(const std::map<std::string, std::vector<std::string> >& config);
         void validate_location_path(const std::map<std::string, std::vector<std::string> >& config);
         void validate_duplicate_server_name_within_listen(const std::map<std::string, std::vector<std::string> >& config);
+        void validate_duplicate_listen_options(const std::map<std::string, std::vector<std::string> >& config);
         void validate_listen_port(const std::map<std::string, std::vector<std::string> >& config);
         void validate_listen_ip(const std::map<std::string, std::vector<std::string> >& config);
+        void validate_listen_options(const std::map<std::string, std::vector<std::string> >& config);
+        void validate_number_values(const std::map<std::string, std::vector<std::string> >& config);
 
         /*parser*/
         std::vector<std::pair<std::map<std::string, std::vector<std::string> >, 
             std::map<std::string, std::map<std::string, std::vector<std::string> > > > > parse_nginx_config();
         void process_line(std::string& line, std::map<std::string, std::vector<std::string> >& current_config, std::map<std::string, std::map<std::string, std::vector<std::string> > >& location_configs, bool& in_server_block, bool& in_location_block,std::string& current_location_path, bool& server_root_seen);
+        void handle_events_block(const std::string& line);
+        const std::string& get_event_backend() const;
+        int get_stall_threshold_ms() const;
         void handle_server_block(const std::string& line, std::map<std::string, std::vector<std::string> >& current_config, std::map<std::string, std::map<std::string, std::vector<std::string> > >& location_configs, bool& in_location_block, std::string& current_location_path, bool& server_root_seen);
 
         /*parser utils*/
         void reset_server_config(std::map<std::string, std::vector<std::string> >& current_config,std::map<std::string, std::map<std::string, std::vector<std::string> > >& location_configs,bool& server_root_seen);
         bool is_server_start(const std::string& line);
+        bool is_events_start(const std::string& line);
         bool is_server_end(const std::string& line, bool in_server_block, bool in_location_block);
         bool is_location_start(const std::string& line);
         bool is_location_end(const std::string& line, bool in_location_block);
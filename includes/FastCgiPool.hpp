@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+FastCgiPool: FastCGI server (UNIX socket) への接続を保持し、再利用する
+- 接続は `fastcgi_pass unix:/path` のaddressごとに管理する
+- 応答を返し終えた接続 (FCGI_KEEP_CONN) をidleとして保持し、次のrequestで使う
+- idle中の接続はMultiplexerの監視対象外
+*/
+class FastCgiPool {
+public:
+  static FastCgiPool &get_instance();
+  static void delete_instance();
+
+  int acquire(const std::string &address);
+  void release(const std::string &address, int fd);
+
+private:
+  typedef std::map<std::string, std::vector<int> > IdleMap;
+  typedef IdleMap::iterator IdleIt;
+
+  static FastCgiPool *instance_;
+  static const size_t k_max_idle_per_address;
+
+  IdleMap idle_;
+
+  int connect_to(const std::string &address);
+  bool is_alive(int fd) const;
+
+  FastCgiPool();
+  ~FastCgiPool();
+  FastCgiPool(const FastCgiPool &other);
+  FastCgiPool &operator=(const FastCgiPool &other);
+};
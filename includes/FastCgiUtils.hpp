@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+FastCGI (version 1) のrecordの組み立てと解析
+*/
+namespace FastCgiUtils {
+
+enum RecordType {
+  FCGI_BEGIN_REQUEST = 1,
+  FCGI_ABORT_REQUEST = 2,
+  FCGI_END_REQUEST = 3,
+  FCGI_PARAMS = 4,
+  FCGI_STDIN = 5,
+  FCGI_STDOUT = 6,
+  FCGI_STDERR = 7
+};
+
+// BEGIN_REQUEST, PARAMS, STDIN を1つの送信bufferにまとめる
+std::vector<char> encode_request(
+    unsigned short request_id,
+    const std::vector<std::pair<std::string, std::string> > &params,
+    const std::vector<char> &body, bool keep_conn);
+
+} // namespace FastCgiUtils
+
+/*
+FastCgiRecordParser:
+FastCGI serverからの受信データをrecord単位に分解し、STDOUTの中身を取り出す
+*/
+class FastCgiRecordParser {
+public:
+  FastCgiRecordParser();
+  ~FastCgiRecordParser();
+
+  void append(const char *data, size_t length);
+  void parse(std::vector<char> &stdout_data);
+  void clear(); // 再利用のため初期状態に戻す (bufferの容量は残す)
+
+  bool is_ended() const;
+  bool is_reusable() const;
+  int get_app_status() const;
+
+private:
+  std::vector<char> buf_;
+  bool ended_;
+  bool has_error_;
+  int app_status_;
+  int protocol_status_;
+
+  FastCgiRecordParser(const FastCgiRecordParser &other);
+  FastCgiRecordParser &operator=(const FastCgiRecordParser &other);
+};
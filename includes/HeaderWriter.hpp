@@ -0,0 +1,50 @@
+#pragma once
+
+#include "ResponseTypes.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+HeaderWriter: status行とheaderを組み立て、渡されたbufferの末尾に追加する
+- iostream を使わない (locale処理と一時bufferの確保を避ける)
+- 固定長の内部bufferに書き、end() / flush() でまとめて1回だけ追加する
+- status行は HttpResponse::get_status_message() の表から作る
+- 数値は自前で10進/16進に変換する
+- Date の値は1秒ごとに1回だけ整形して使い回す
+*/
+class HeaderWriter {
+public:
+  explicit HeaderWriter(std::vector<char> &out);
+  ~HeaderWriter();
+
+  void status_line(int status_code);
+  void header(const char *name, const std::string &value);
+  void header(const char *name, const char *value);
+  void header(const std::string &name, const std::string &value);
+  void header(const char *name, size_t value);
+  void date_header();
+  void connection_header(ConnectionPolicy conn);
+  void end();
+  void flush();
+  size_t size() const;
+
+  void append(const char *data, size_t length);
+  void append(const char *str);
+  void append(const std::string &str);
+  void append_decimal(size_t value);
+  void append_hex(size_t value);
+
+  static const char *http_date();
+  static const size_t k_date_length = 29; // "Sun, 06 Nov 1994 08:49:37 GMT"
+
+private:
+  static const size_t k_buffer_size = 512; // 典型的なheaderが収まる大きさ
+
+  std::vector<char> *out_;
+  char buffer_[k_buffer_size];
+  size_t buffered_; // buffer_ のうち、まだ out_ に移していないバイト数
+
+  HeaderWriter(const HeaderWriter &other);
+  HeaderWriter &operator=(const HeaderWriter &other);
+};
@@ -55,8 +55,8 @@ public:
   std::vector<std::string> allow_methods_;
   std::map<int, std::string> error_page_map_;
 
-  ConfigMap server_config_;
-  LocationMap location_configs_;
+  const ConfigMap *server_config_;     // 選択したServerのconfigを参照する
+  const LocationMap *location_configs_; // 同上
   ConfigMap best_match_config_;
 
   HttpRequest(int fd, const VirtualHostRouter *router,
@@ -70,7 +70,9 @@ public:
 
   const std::string &get_method() const { return method_; }
   const std::string &get_path() const { return path_; }
+  const std::string &get_version() const { return version_; }
   const std::vector<char> &get_body() const { return body_data_; }
+  int get_client_fd() const { return client_fd_; }
 
   size_t get_body_size() const { return body_size_; }
   void set_body_size(size_t size) { body_size_ = size; }
@@ -79,21 +81,28 @@ public:
   int get_status_code() const;
   void load_max_body_size();
   size_t get_max_body_size() const;
+  // `slow_request_ms 500;` より時間のかかったrequestをlogに出す; 0なら出さない
+  size_t get_slow_request_ms() const { return slow_request_ms_; }
+  // server, locationを決めた時刻 (Metrics::now_usec()); 0は未決定
+  unsigned long long get_routed_at() const { return routed_at_; }
 
   const std::string &get_header_value(const std::string &key) const;
   const std::vector<std::string> &
   get_header_values(const std::string &key) const;
-  void add_header(const std::string &key, const std::string &value);
+  void add_header(const std::string &key, const char *value, size_t length);
   bool is_in_headers(const std::string &key) const;
 
   // リクエストの解析
   ConfigMap get_best_match_config(const std::string &path);
 
   void clear();
+  void attach(int fd, const VirtualHostRouter *router);
+  void recycle();
 
   bool has_cgi_session() const;
   CgiSession *get_cgi_session() const;
   void clear_cgi_session();
+  void detach_cgi_session();
 
 private:
   int client_fd_;
@@ -105,6 +114,8 @@ private:
   int status_code_;
   std::string _root;
   size_t max_body_size_;
+  unsigned long long routed_at_;
+  size_t slow_request_ms_; // 選択したServerの値
 
   static const size_t k_default_max_body_;
 
@@ -135,7 +146,10 @@ private:
   void handle_file_request(const std::string &file_path);
 
   RedirStatus handle_redirection();
+  bool is_stub_status_location() const;
+  void handle_stub_status();
   void launch_cgi(const std::string &cgi_path);
+  void launch_fastcgi();
 
   bool validate_client_body_size();
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "HttpRequest.hpp"
+#include "RequestArena.hpp"
 #include <sstream>
 #include <string>
 #include <vector>
@@ -9,11 +10,12 @@ class HttpRequest;
 
 class HttpRequestParser {
 public:
-  HttpRequestParser(HttpRequest &http_request);
+  HttpRequestParser(HttpRequest &http_request, RequestArena &request_arena);
   ~HttpRequestParser();
 
   bool parse();                                      // データ解析
   void clear();                                      // 状態reset
+  void recycle(); // 未解析のdataも捨てる (Clientの再利用時)
   void append_data(const char *data, size_t length); // データ追加
 
 private:
@@ -28,6 +30,7 @@ private:
   static const size_t k_max_request_target;
 
   HttpRequest &request;
+  RequestArena &arena; // 解析中の一時領域; clear() でreset
   ParseState parse_state;
   std::vector<char> recv_buffer;
 
@@ -36,8 +39,10 @@ private:
   void parse_body();
   void parse_chunked_body();
 
-  bool parse_request_line(std::string &line);
-  bool parse_header_line(std::string &line);
+  static bool next_line(const char *&pos, const char *end, const char *&line,
+                        size_t &length);
+  bool parse_request_line(const char *line, size_t length);
+  bool parse_header_line(const char *line, size_t length);
 
   void validate_request_content();
   bool check_framing_error();
@@ -14,18 +14,21 @@
 
 #include "ResponseTypes.hpp"
 #include <cstddef>
-#include <iostream>
-#include <queue>
-#include <sstream>
+#include <deque>
 #include <string>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
 
 // HttpResponse はレスポンスキュー管理の責務
 
+// header / body / chunkの枠 を別々のsegmentとして持ち、writevでまとめて送る
+// bodyはswapでsegmentに移すので、queueに積む際にコピーしない
 struct ResponseEntry {
-  ConnectionPolicy conn;    // 送信後の接続処理
-  std::vector<char> buffer; // レスポンス本体（header＋body含む）
-  size_t offset;            // 送信済みバイト数
+  ConnectionPolicy conn;                    // 送信後の接続処理
+  std::vector<std::vector<char> > segments; // 送信するbufferの列
+  size_t length;                            // 全segmentの合計バイト数
+  size_t offset;                            // 送信済みバイト数（segment通算）
 };
 
 class HttpResponse {
@@ -35,30 +38,45 @@ public:
 
   ResponseEntry *get_front_response();
   bool has_response() const;
-  void push_back_response(ConnectionPolicy conn, const std::vector<char> &buf);
-  void push_back_response(ConnectionPolicy conn, std::ostringstream &oss);
+  size_t get_queued_bytes() const;
+  int get_last_status() const { return last_status_; }
+  size_t get_total_bytes() const { return total_bytes_; } // 積んだ累計
   void pop_front_response();
+  void clear(); // 未送信の応答を捨てる (Clientの再利用時)
 
-  void generate_response(int status_code, const std::vector<char> &content,
+  int fill_iovec(struct iovec *iov, int max_iov) const;
+
+  // NOTE: body / content を受け取る関数は、中身をswapで移す（呼び出し後は空）
+  void generate_response(int status_code, std::vector<char> &content,
                          const std::string &content_type,
                          ConnectionPolicy connection_policy);
 
   void generate_response(
       int status_code,
       const std::vector<std::pair<std::string, std::string> > &headers,
-      const std::vector<char> &body, ConnectionPolicy connnection_policy);
+      std::vector<char> &body, ConnectionPolicy connnection_policy);
 
   void generate_created_response(const std::string &location,
-                                 const std::vector<char> &content,
+                                 std::vector<char> &content,
                                  const std::string &content_type,
                                  ConnectionPolicy conn);
 
+  void generate_response_header(
+      int status_code,
+      const std::vector<std::pair<std::string, std::string> > &headers,
+      ConnectionPolicy connnection_policy);
+
+  void generate_response_body(std::vector<char> &body,
+                              ConnectionPolicy connection_policy);
+
+  void generate_connection_close(ConnectionPolicy connection_policy);
+
   void generate_chunk_response_header(
       int status_code,
       const std::vector<std::pair<std::string, std::string> > &headers,
       ConnectionPolicy connnection_policy);
 
-  void generate_chunk_response_body(const std::vector<char> &body);
+  void generate_chunk_response_body(std::vector<char> &body);
 
   void generate_chunk_response_last(ConnectionPolicy connnection_policy);
 
@@ -78,11 +96,31 @@ public:
 
   void generate_timeout_response();
 
-private:
-  std::queue<ResponseEntry> response_queue_;
+  static const char *get_status_message(int status_code);
 
-  const char *get_status_message(int status_code);
-  const char *to_connection_value(ConnectionPolicy conn) const;
+private:
+  // pipelineされた複数の応答をまとめて送るため、queueではなくdequeで走査する
+  std::deque<ResponseEntry> response_queue_;
+  size_t queued_bytes_; // queue内の未送信バイト数の目安 (CGIの読み込み抑制用)
+  int last_status_;     // 最後に積んだ応答のstatus code (access log用)
+  size_t total_bytes_;  // これまでに積んだバイト数; clear() でも戻さない
+
+  void record_status(int status_code);
+
+  ResponseEntry &push_back_entry(ConnectionPolicy conn);
+  void append_segment(ResponseEntry &entry, std::vector<char> &data);
+  void append_segment(ResponseEntry &entry, const std::string &data);
+
+  static int fill_entry_iovec(const ResponseEntry &entry, struct iovec *iov,
+                              int max_iov);
+
+  void push_back_rendered(ConnectionPolicy conn, std::vector<char> &data);
+  void push_back_simple(int status_code, const std::string &content_type,
+                        const std::string &body, ConnectionPolicy conn);
+  static void
+  write_header(std::vector<char> &out, int status_code,
+               const std::vector<std::pair<std::string, std::string> > &headers,
+               ConnectionPolicy conn);
 
   HttpResponse(const HttpResponse &other);
   HttpResponse &operator=(const HttpResponse &other);
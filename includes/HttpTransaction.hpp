@@ -4,7 +4,9 @@
 #include "HttpRequest.hpp"
 #include "HttpRequestParser.hpp"
 #include "HttpResponse.hpp"
+#include "RequestArena.hpp"
 #include <cstddef>
+#include <string>
 
 class VirtualHostRouter;
 
@@ -17,6 +19,15 @@ enum IOStatus {
   IO_SHOULD_CLOSE     // close(fd)
 };
 
+// requestの区間の境界の時刻 (Metrics::now_usec()); 0は未到達
+// server, locationを決めた時刻は HttpRequest::get_routed_at()
+struct RequestTimes {
+  unsigned long long accepted;  // 接続の受け入れ; 最初のrequestの後は0
+  unsigned long long received;  // requestの最初のbyte
+  unsigned long long parsed;    // header, bodyの解析完了
+  unsigned long long responded; // 応答の最初のbyteをqueueに積んだ
+};
+
 /*
 HttpTransaction: リクエストの解析, CGI遷移, レスポンスの準備状態管理
  */
@@ -25,6 +36,9 @@ public:
   HttpTransaction(int fd, const VirtualHostRouter *router);
   ~HttpTransaction();
 
+  void attach(int fd, const VirtualHostRouter *router);
+  void recycle();
+
   void append_data(const char *raw, size_t length);
   void process_data();
   void process_cgi_session();
@@ -36,13 +50,25 @@ public:
 
   bool has_response() const;
   ResponseEntry *get_response();
+  int fill_iovec(struct iovec *iov, int max_iov) const;
   void pop_response();
+  void on_response_flushed(); // response queueを送り切った (Clientから)
+  const std::string &get_request_line() const { return request_line_; }
 
 private:
   int client_fd_;
   HttpResponse response_;    // responseの生成とqueue管理
   HttpRequest request_;      // header情報, body, contentLengthなどの管理
+  RequestArena arena_;       // 解析中の一時領域 (requestごとにreset)
   HttpRequestParser parser_; // header, bodyの解析管理
+  RequestTimes times_;
+  unsigned long long flush_started_; // 送信待ちの応答を積み終えた時刻; 0はなし
+  size_t bytes_at_parsed_; // 解析完了時の response_.get_total_bytes()
+  std::string request_line_; // 最後に解析したrequestの "METHOD path" (stallのlog用)
+
+  void finish_request(size_t relayed_bytes);
+  void write_access_log(unsigned long long now, size_t relayed_bytes);
+  void log_slow_request(unsigned long long now, unsigned long long routed);
 
   HttpTransaction(const HttpTransaction &other);
   HttpTransaction &operator=(const HttpTransaction &other);
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Multiplexer.hpp"
+#include <map>
+#include <vector>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+/**
+ * io_uring を用いたI/Oの多重化
+ * - fdごとに one-shot の IORING_OP_POLL_ADD を登録し、発火したら登録し直す
+ *   (one-shotは登録時に準備状態を見るので、epollと同じlevel-triggeredになる)
+ * - 監視の変更 (登録 / 取り消し) はSQEとして溜め、待機と同じ
+ *   io_uring_enter() 1回でまとめて投入する
+ * - SQが一杯で投入もできなければ、変更を控えて次の周回で登録し直す
+ *   (handlerの途中で例外にしてserverを止めない)
+ * - kernelが対応していなければ EpollMultiplexer を使う
+ */
+class IoUringMultiplexer : public Multiplexer {
+public:
+  static Multiplexer &get_instance();
+
+  void run();
+
+protected:
+  void monitor_read(int fd);
+  void monitor_write(int fd);
+  void unmonitor_write(int fd);
+  void unmonitor(int fd);
+  void monitor_pipe_read(int fd);
+  void monitor_pipe_write(int fd);
+  void unmonitor_pipe_read(int fd);
+
+private:
+  // 監視中のfdの状態
+  struct Watch {
+    unsigned mask;            // POLLIN / POLLOUT
+    unsigned long long armed; // 登録中のpollのuser_data; 0は未登録
+  };
+
+  // 完了したpoll (処理はCQを読み終えてから行う)
+  struct Completion {
+    int fd;
+    unsigned long long user_data;
+    int res; // revents, または -errno
+  };
+
+  typedef std::map<int, Watch> WatchMap;
+  typedef WatchMap::iterator WatchIt;
+
+  static const unsigned k_ring_entries = 1024;
+
+  int ring_fd_;
+  void *sq_ring_;
+  size_t sq_ring_size_;
+  void *cq_ring_;
+  size_t cq_ring_size_;
+  struct io_uring_sqe *sqes_;
+  size_t sqes_size_;
+
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned *sq_array_;
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe *cqes_;
+
+  unsigned to_submit_; // 溜まっているSQEの数
+  unsigned generation_;
+  WatchMap watches_;
+  std::vector<int> rearm_;
+  std::vector<int> deferred_arms_; // SQが一杯で登録できなかったfd
+  std::vector<unsigned long long> deferred_cancels_; // 同じく取り消し
+  std::vector<Completion> completions_;
+
+  void set_mask(int fd, unsigned mask);
+  void arm(int fd, Watch &watch);
+  void cancel(Watch &watch);
+  void retry_deferred();
+  struct io_uring_sqe *get_sqe();
+  bool submit_and_wait(int timeout_ms);
+  void reap_completions();
+  void setup_ring();
+  void release_ring();
+
+  IoUringMultiplexer();
+  IoUringMultiplexer(const IoUringMultiplexer &other);
+  ~IoUringMultiplexer();
+
+  IoUringMultiplexer &operator=(const IoUringMultiplexer &other);
+};
@@ -18,6 +18,7 @@ protected:
   void unmonitor(int fd);
   void monitor_pipe_read(int fd);
   void monitor_pipe_write(int fd);
+  void unmonitor_pipe_read(int fd);
 
 private:
   typedef std::vector<struct kevent> KeventVec;
@@ -6,14 +6,42 @@
 
 enum LogLevel { LOG_FUNC, LOG_INFO, LOG_DEBUG, LOG_WARNING, LOG_ERROR };
 
+// build時の下限 (Makefileの LOG_LEVEL); これ未満のlogはcompile時に消える
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1 // LOG_INFO
+#endif
+
 extern LogLevel current_log_level;
 
 void log(LogLevel level, const std::string &message);
 void logfd(LogLevel level, const std::string &prefix, int fd);
 
-#define LOG_DEBUG_FUNC() log(LOG_FUNC, std::string(__func__) + "() called")
+// levelがこのbuildで出力され得るか; LOG_DEBUG は log() が出力しない
+// 定数式なので、-O0 でも偽になる分岐はcompile時に消える
+#define LOG_COMPILED(level) ((level) >= LOG_LEVEL && (level) != LOG_DEBUG)
+
+// levelのmessageが出力されるか
+inline bool is_log_enabled(LogLevel level) {
+  return LOG_COMPILED(level) && level >= current_log_level;
+}
+
+// 出力しないlevelでは、messageの文字列を組み立てない
+#define LOG(level, message)                                                    \
+  do {                                                                         \
+    if (LOG_COMPILED(level) && (level) >= current_log_level)                   \
+      log(level, message);                                                     \
+  } while (0)
+#define LOG_FD(level, prefix, fd)                                              \
+  do {                                                                         \
+    if (LOG_COMPILED(level) && (level) >= current_log_level)                   \
+      logfd(level, prefix, fd);                                                \
+  } while (0)
+
+// 関数の呼び出しtrace; LOG_LEVEL=0 (make func) のbuild以外では何も残らない
+#define LOG_DEBUG_FUNC()                                                       \
+  LOG(LOG_FUNC, std::string(__func__) + "() called")
 #define LOG_DEBUG_FUNC_FD(fd)                                                  \
-  logfd(LOG_FUNC, std::string(__func__) + "() called on fd: ", fd)
+  LOG_FD(LOG_FUNC, std::string(__func__) + "() called on fd: ", fd)
 
 #define RED "\033[1;31m"
 #define GREEN "\033[1;32m"
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class ClientRegistry;
+class CgiRegistry;
+
+/*
+LatencyHistogram: 所要時間 (マイクロ秒) の分布
+- bucket i には 2^(i-1) 以上 2^i 未満の値を数える (0 は bucket 0)
+- 記録はbit幅を数えて加算するだけで、割り当ても探索もしない
+*/
+class LatencyHistogram {
+public:
+  static const int k_buckets = 40; // 2^39 us (約6日) まで
+
+  LatencyHistogram();
+
+  void observe(unsigned long long usec);
+
+  unsigned long long get_count() const;
+  unsigned long long get_sum() const;
+  unsigned long long get_bucket(int index) const;
+  // 上限が 2^index us の bucket; index は 0 から k_buckets - 1
+
+private:
+  unsigned long long buckets_[k_buckets];
+  unsigned long long count_;
+  unsigned long long sum_;
+};
+
+/*
+Metrics: 稼働中の計測値を集め、Prometheusのtext形式で返す
+- 計数はevent loopの中で行うので、単純な加算だけにする (single thread)
+- 接続数やCGIの数はregistryが持っているので、出力時に問い合わせる
+- `location /metrics { stub_status on; }` への GET で返す
+*/
+class Metrics {
+public:
+  enum TimeoutKind {
+    TIMEOUT_CLIENT,       // requestが時間内に届かなかった
+    TIMEOUT_CGI,          // CGIが時間内に終わらなかった
+    TIMEOUT_UNRESPONSIVE, // timeout応答を送れず、強制的に閉じた
+    TIMEOUT_KINDS
+  };
+  // requestの処理の区間; 境界の時刻はHttpTransactionが控える
+  enum RequestPhase {
+    REQUEST_WAIT,   // accept -> 最初のbyte (接続の最初のrequestのみ)
+    REQUEST_PARSE,  // 最初のbyte -> header, bodyの解析完了
+    REQUEST_ROUTE,  // 解析完了 -> server, locationの決定
+    REQUEST_HANDLE, // location決定 -> 応答の最初のbyteをqueueに積む
+    REQUEST_FLUSH,  // 応答を積み終える -> socketに書き終える
+    REQUEST_PHASES
+  };
+
+  static Metrics &get_instance() {
+    if (!instance_) {
+      create_instance();
+    }
+    return *instance_;
+  }
+  static void delete_instance();
+
+  static unsigned long long now_usec(); // 単調増加の時刻
+
+  void set_registries(const ClientRegistry *clients, const CgiRegistry *cgis);
+
+  void count_accept() { ++accepts_; }
+  void count_loop_iteration() { ++loop_iterations_; }
+  void count_bytes_in(size_t bytes) { bytes_in_ += bytes; }
+  void count_bytes_out(size_t bytes) { bytes_out_ += bytes; }
+  void count_timeouts(TimeoutKind kind, size_t count) {
+    timeouts_[kind] += count;
+  }
+  void count_response(int status_code);
+  void observe_request(unsigned long long usec) {
+    request_latency_.observe(usec);
+  }
+  void observe_phase(RequestPhase phase, unsigned long long usec) {
+    phase_latency_[phase].observe(usec);
+  }
+  void observe_loop(unsigned long long usec) { loop_latency_.observe(usec); }
+  void count_stall() { ++stalls_; }
+
+  // event処理1件の中で最も遅かった同期処理 (SlowOpScope) を控える
+  void record_op(const char *name, unsigned long long usec) {
+    if (usec >= slowest_op_usec_) {
+      slowest_op_ = name;
+      slowest_op_usec_ = usec;
+    }
+  }
+  void reset_slowest_op() {
+    slowest_op_ = NULL;
+    slowest_op_usec_ = 0;
+  }
+  const char *get_slowest_op() const { return slowest_op_; }
+  unsigned long long get_slowest_op_usec() const { return slowest_op_usec_; }
+
+  void render(std::string &out) const;
+
+private:
+  static Metrics *instance_;
+  static const int k_max_status = 600;
+
+  const ClientRegistry *clients_;
+  const CgiRegistry *cgis_;
+  unsigned long long started_at_; // now_usec()
+
+  unsigned long long accepts_;
+  unsigned long long loop_iterations_;
+  unsigned long long bytes_in_;
+  unsigned long long bytes_out_;
+  unsigned long long stalls_;
+  unsigned long long timeouts_[TIMEOUT_KINDS];
+  unsigned long long responses_[k_max_status]; // status codeごと
+  LatencyHistogram request_latency_;
+  LatencyHistogram phase_latency_[REQUEST_PHASES];
+  LatencyHistogram loop_latency_; // 1周で処理に使った時間 (待機を除く)
+  const char *slowest_op_;
+  unsigned long long slowest_op_usec_;
+
+  static void create_instance();
+
+  Metrics();
+  ~Metrics();
+  Metrics(const Metrics &other);
+  Metrics &operator=(const Metrics &other);
+};
+
+/*
+SlowOpScope: event loopを止め得る同期処理 (file I/O, fork等) を囲む
+- 所要時間を Metrics::record_op() に渡し、stallのlogで原因として示す
+*/
+class SlowOpScope {
+public:
+  explicit SlowOpScope(const char *name)
+      : name_(name), started_(Metrics::now_usec()) {}
+  ~SlowOpScope() {
+    Metrics::get_instance().record_op(name_, Metrics::now_usec() - started_);
+  }
+
+private:
+  const char *name_;
+  unsigned long long started_;
+
+  SlowOpScope(const SlowOpScope &other);
+  SlowOpScope &operator=(const SlowOpScope &other);
+};
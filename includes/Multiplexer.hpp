@@ -2,6 +2,7 @@
 
 #include <cstddef>
 #include <map>
+#include <string>
 #include <sys/types.h>
 #include <vector>
 
@@ -11,6 +12,24 @@ class CgiSession;
 class ServerRegistry;
 class ClientRegistry;
 class CgiRegistry;
+class ChildReaper;
+
+// process_events() の処理段階
+enum LoopPhase {
+  PHASE_ACCEPT,  // 新しい接続の受け付け
+  PHASE_READ,    // client socketからの受信, CGIのpipe I/O
+  PHASE_PROCESS, // parseと応答の生成
+  PHASE_FLUSH,   // 接続ごとに1回の送信
+  PHASE_COUNT
+};
+
+// event loopの計測値
+struct LoopStats {
+  unsigned long long iterations;
+  unsigned long long events;
+  unsigned long long handled[PHASE_COUNT]; // 各phaseで扱ったfdの数
+  unsigned long long usec[PHASE_COUNT];    // 各phaseの所要時間
+};
 
 /**
  * Server の I/O 多重化を管理する基底クラス
@@ -21,6 +40,10 @@ public:
   static Multiplexer &get_instance();
   static void delete_instance();
 
+  // get_instance() より前に呼ぶ; この環境で使えない名前ならfalse
+  // epoll / io_uring (Linux), kqueue (macOS, BSD), poll, select
+  static bool set_backend(const std::string &name);
+
   virtual void run() = 0;
 
   // 監視fd管理用の純粋仮想関数
@@ -31,22 +54,40 @@ public:
 
   virtual void monitor_pipe_read(int fd) = 0;
   virtual void monitor_pipe_write(int fd) = 0;
+  virtual void unmonitor_pipe_read(int fd) = 0;
 
   void set_server_registry(ServerRegistry *registry);
   void set_client_registry(ClientRegistry *registry);
   void set_cgi_registry(CgiRegistry *registry);
+  void set_child_reaper(ChildReaper *reaper);
 
   void register_cgi_fd(int fd, CgiSession *session);
   void cleanup_cgi(int cgi_fd);
 
+  const LoopStats &get_loop_stats() const;      // 起動からの合計
+  const LoopStats &get_last_loop_stats() const; // 直前の1周
+
+  // event処理1件がこれ以上かかったらlogに出す (0で無効)
+  void set_stall_threshold_ms(int ms);
+
 protected:
   // Singleton pattern
   static Multiplexer *instance_;
+  static std::string backend_; // 空なら環境ごとの既定
 
   static const int k_timeout_ms_;
+  static const int k_default_stall_threshold_ms_;
+
+  struct ReadyEvent {
+    int fd;
+    bool readable;
+    bool writable;
+  };
 
   // I/O多重化処理の管理
   void process_event(int fd, bool readable, bool writable);
+  // 1回の待機で得たeventをまとめて、phaseごとに処理する
+  void process_events(const std::vector<ReadyEvent> &events);
   void handle_timeouts();
 
   Multiplexer();
@@ -58,6 +99,14 @@ private:
   ServerRegistry *server_registry_;
   ClientRegistry *client_registry_;
   CgiRegistry *cgi_registry_;
+  ChildReaper *child_reaper_;
+
+  // process_events() で、eventごとに後のphaseで行う処理
+  std::vector<unsigned char> pending_;
+  LoopStats loop_stats_;
+  LoopStats last_loop_stats_;
+  unsigned long long stall_threshold_usec_;
+  unsigned long long busy_usec_; // この周回でevent処理に使った時間
 
   // I/O多重化処理の補助関数
   void accept_client(int server_fd);
@@ -65,10 +114,20 @@ private:
   void write_to_client(int client_fd);
   void shutdown_write(int client_fd);
   void cleanup_client(int client_fd);
+  bool receive_from_client(int client_fd);
+  bool process_client(int client_fd);
+  void flush_client(int client_fd, bool write_monitored);
+  void log_loop_stats() const;
+
+  // event処理1件の所要時間を測り、長すぎればstallとしてlogに出す
+  unsigned long long begin_handler();
+  void end_handler(int fd, const char *phase, unsigned long long started);
+  void report_stall(int fd, const char *phase, unsigned long long usec);
 
   // CGIのfdを扱う関数
   void read_from_cgi(int cgi_stdout);
   void write_to_cgi(int cgi_stdin);
+  void reap_children();
 
   // 代入禁止
   Multiplexer &operator=(const Multiplexer &other);
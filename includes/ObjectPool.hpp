@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+struct PoolStats {
+  size_t created;   // newした数 (preallocateを含む)
+  size_t reused;    // 待機中のobjectを渡した数
+  size_t released;  // 待機に戻した数
+  size_t discarded; // 待機数の上限を超えてdeleteした数
+};
+
+/*
+ObjectPool: 接続ごとに作り直していたobjectを、deleteせずに再利用する
+- T には T() と recycle() と is_idle() が必要
+  - T(): preallocate用; 何にも結び付いていない待機状態を作る
+  - recycle(): fdなど接続固有のものを手放し、bufferは容量を残して空にする
+  - is_idle(): 待機状態か (返却後も使われ続けていないかの確認用)
+- acquire() で受け取ったobjectは、呼び出し側で接続の情報を設定し直す
+- 待機数は capacity まで; 超えた分は通常どおりdeleteする
+*/
+template <typename T> class ObjectPool {
+public:
+  static ObjectPool &get_instance() {
+    if (!instance_) {
+      instance_ = new ObjectPool();
+      std::atexit(ObjectPool::delete_instance);
+    }
+    return *instance_;
+  }
+
+  static void delete_instance() {
+    if (instance_) {
+      delete instance_;
+    }
+    instance_ = 0;
+  }
+
+  void set_capacity(size_t capacity) {
+    capacity_ = capacity;
+    while (free_.size() > capacity_) {
+      delete free_.back();
+      free_.pop_back();
+    }
+  }
+
+  // 起動時に呼ぶ: 最初の接続からnewを避ける
+  void preallocate(size_t count) {
+    while (free_.size() < count && free_.size() < capacity_) {
+      free_.push_back(new T());
+      ++stats_.created;
+    }
+  }
+
+  // 待機中のobjectがあれば返す; なければNULL (呼び出し側でnewする)
+  T *acquire() {
+    if (free_.empty()) {
+      ++stats_.created;
+      return NULL;
+    }
+    T *object = free_.back();
+    free_.pop_back();
+    assert(object->is_idle());
+    ++stats_.reused;
+    return object;
+  }
+
+  void release(T *object) {
+    if (!object) {
+      return;
+    }
+    if (free_.size() >= capacity_) {
+      delete object;
+      ++stats_.discarded;
+      return;
+    }
+    object->recycle();
+    free_.push_back(object);
+    ++stats_.released;
+  }
+
+  size_t get_free_count() const { return free_.size(); }
+  const PoolStats &get_stats() const { return stats_; }
+
+private:
+  static ObjectPool *instance_;
+  static const size_t k_default_capacity = 64;
+
+  std::vector<T *> free_;
+  size_t capacity_;
+  PoolStats stats_;
+
+  ObjectPool() : free_(), capacity_(k_default_capacity) {
+    stats_.created = 0;
+    stats_.reused = 0;
+    stats_.released = 0;
+    stats_.discarded = 0;
+  }
+
+  ~ObjectPool() {
+    for (size_t i = 0; i < free_.size(); ++i) {
+      delete free_[i];
+    }
+  }
+
+  ObjectPool(const ObjectPool &other);
+  ObjectPool &operator=(const ObjectPool &other);
+};
+
+template <typename T> ObjectPool<T> *ObjectPool<T>::instance_ = 0;
+
+// 再利用するbufferが大きくなりすぎていたら、容量ごと手放す
+static const size_t k_max_pooled_buffer = 64 * 1024;
+
+template <typename Buffer>
+void release_buffer(Buffer &buffer, size_t max_capacity = k_max_pooled_buffer) {
+  if (buffer.capacity() > max_capacity) {
+    Buffer().swap(buffer);
+  } else {
+    buffer.clear();
+  }
+}
@@ -21,6 +21,7 @@ protected:
 
   void monitor_pipe_read(int fd);
   void monitor_pipe_write(int fd);
+  void unmonitor_pipe_read(int fd);
 
 private:
   typedef std::vector<struct pollfd> PollFdVec;
@@ -28,11 +29,16 @@ private:
   typedef std::vector<struct pollfd>::const_iterator ConstPollFdIt;
 
   PollFdVec pfds;
+  // fd -> pfds の添字; 監視していないfdは -1
+  std::vector<int> fd_to_index;
+  // poll() で準備ができたfd; 処理中のpfdsの変更に影響されないよう控える
+  PollFdVec ready;
 
   bool is_readable(struct pollfd fd) const;
   bool is_writable(struct pollfd fd) const;
 
   PollFdIt find_pollfd(int fd);
+  void add_pollfd(int fd, short events);
 
   PollMultiplexer();
   PollMultiplexer(const PollMultiplexer &other);
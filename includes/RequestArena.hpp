@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+struct ArenaStats {
+  size_t bytes;  // 割り当てた累計バイト数
+  size_t resets; // reset() の回数
+  size_t spills; // blockに収まらず、mallocに回した回数
+  size_t blocks; // 確保したblockの累計数
+};
+
+/*
+RequestArena: 1つのrequestの解析中だけ使う一時領域のbump allocator
+- 固定長のblockを先頭から切り出すだけで、個別のfreeはしない
+- HttpRequestParser::clear() (requestの終わり) で reset() し、O(1)で全て解放
+- blockは次のrequestのために保持する (k_max_retained_blocksまで)
+- blockより大きい要求はmallocし (spill)、reset() で解放する
+*/
+class RequestArena {
+public:
+  RequestArena();
+  ~RequestArena();
+
+  void *allocate(size_t size);
+  char *copy(const char *data, size_t length);
+  void reset();
+
+  const ArenaStats &get_stats() const;
+  static const ArenaStats &get_total_stats(); // 全connectionの合計
+
+private:
+  static const size_t k_block_size = 4096;
+  static const size_t k_max_retained_blocks = 4;
+  static const size_t k_alignment = sizeof(void *);
+
+  static ArenaStats total_stats_;
+
+  std::vector<char *> blocks_;
+  size_t current_;        // 使用中のblockの添字
+  size_t offset_;         // 使用中のblock内の次の位置
+  std::vector<void *> spills_;
+  ArenaStats stats_;
+
+  void count(size_t bytes);
+
+  RequestArena(const RequestArena &other);
+  RequestArena &operator=(const RequestArena &other);
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "ResponseTypes.hpp"
+#include "types.hpp"
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ResponseTemplates: error / redirect / timeout の応答を、送信できるbyte列として
+あらかじめ組み立てておく
+- status行, header, bodyは固定; 応答ごとに変わるのは Date と Connection だけ
+- Connection は keep-alive / close の2通りを持ち、Date の枠だけを上書きする
+- 既知のstatusとtimeoutは起動時に、error_page / return はconfig読み込み時に作る
+- error_pageのfileは読み込み時に1回だけ読む (以降の変更は再起動で反映)
+*/
+class ResponseTemplates {
+public:
+  static ResponseTemplates &get_instance();
+  static void delete_instance();
+
+  void compile(const ServerAndLocationConfigs &configs);
+
+  // 見つかれば out に応答全体を入れて true を返す
+  bool render_error(int status_code, ConnectionPolicy conn,
+                    std::vector<char> &out);
+  bool render_error(int status_code, const std::string &message,
+                    ConnectionPolicy conn, std::vector<char> &out);
+  bool render_custom_error(int status_code, const std::string &file_path,
+                           ConnectionPolicy conn, std::vector<char> &out);
+  bool render_redirect(int status_code, const std::string &location,
+                       ConnectionPolicy conn, std::vector<char> &out);
+  void render_timeout(std::vector<char> &out);
+
+private:
+  struct Template {
+    std::vector<char> keep_alive; // Connection: keep-alive 版
+    std::vector<char> close;      // Connection: close 版
+    size_t date_offset;           // Date の値の位置 (両方で同じ)
+  };
+  typedef std::pair<int, std::string> Key;
+  typedef std::map<int, Template> StatusMap;
+  typedef std::map<Key, Template> KeyMap;
+
+  static ResponseTemplates *instance_;
+
+  StatusMap errors_;
+  KeyMap messages_;      // generate_error_response(status, message) 用
+  KeyMap custom_errors_; // (status, root + error_page)
+  KeyMap redirects_;     // (status, return の転送先)
+  Template timeout_;
+
+  static Template build(int status_code, const std::string &location,
+                        const std::string &content_type,
+                        const std::string &body);
+  static void build_one(std::vector<char> &out, size_t &date_offset,
+                        int status_code, const std::string &location,
+                        const std::string &content_type,
+                        const std::string &body, ConnectionPolicy conn);
+  void compile_context(const ConfigMap &config);
+  void render(const Template &tmpl, ConnectionPolicy conn,
+              std::vector<char> &out);
+
+  ResponseTemplates();
+  ~ResponseTemplates();
+  ResponseTemplates(const ResponseTemplates &other);
+  ResponseTemplates &operator=(const ResponseTemplates &other);
+};
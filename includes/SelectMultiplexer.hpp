@@ -20,6 +20,7 @@ protected:
 
   void monitor_pipe_read(int fd);
   void monitor_pipe_write(int fd);
+  void unmonitor_pipe_read(int fd);
 
 private:
   fd_set read_fds;  // 常時監視
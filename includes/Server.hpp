@@ -18,12 +18,14 @@ public:
   const std::vector<std::string> &get_server_names() const;
 
   bool is_default_server() const;
+  size_t get_slow_request_ms() const; // 0なら遅いrequestをlogに出さない
 
 private:
   ConfigMap server_config_;
   LocationMap location_configs_;
 
   bool _is_default;
+  size_t slow_request_ms_; // 起動時に slow_request_ms を解析しておく
 
   Server();
   Server &operator=(const Server &src);
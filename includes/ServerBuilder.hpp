@@ -8,4 +8,5 @@ class ServerBuilder {
 public:
   static void build(const ServerAndLocationConfigs &config_pairs,
                     ServerRegistry &registry);
+  static void preallocate_pools(const ServerAndLocationConfigs &config_pairs);
 };
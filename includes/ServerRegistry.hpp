@@ -1,5 +1,6 @@
 #pragma once
 
+#include "SocketBuilder.hpp"
 #include <cstddef>
 #include <map>
 #include <string>
@@ -12,6 +13,7 @@ struct ListenEntry {
   int fd;
   std::string ip;
   std::string port;
+  ListenOptions options;
   VirtualHostRouter *virtual_host_router;
 };
 
@@ -28,6 +30,7 @@ public:
   void initialize();
 
   const VirtualHostRouter *get_router(int fd) const;
+  const ListenOptions *get_listen_options(int fd) const;
 
 private:
   std::vector<ListenEntry> entries;
@@ -36,7 +39,7 @@ private:
   typedef std::vector<ListenEntry>::const_iterator ConstListenEntryIt;
 
   void create_new_listen_target(const std::string &ip, const std::string &port,
-                                const Server &s);
+                                const ListenOptions &options, const Server &s);
 
   ServerRegistry(const ServerRegistry &other);
   ServerRegistry &operator=(const ServerRegistry &other);
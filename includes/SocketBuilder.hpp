@@ -2,7 +2,27 @@
 
 #include <string>
 
+// listen directiveでaddressの後ろに書くparameter
+// (例: listen 8080 backlog=511 deferred fastopen=256 nodelay=on cork=on;)
+struct ListenOptions {
+  int backlog;   // listen(2) のbacklog; 既定は SOMAXCONN
+  bool deferred; // TCP_DEFER_ACCEPT: requestが届くまでacceptを通知しない
+  int fastopen;  // TCP_FASTOPEN のqueue長; 0は無効
+  bool nodelay;  // keep-aliveのclient socketに TCP_NODELAY (既定 on)
+  bool cork;     // 書き切れなかった応答を TCP_CORK でまとめて送る (既定 on)
+
+  ListenOptions();
+};
+
 class SocketBuilder {
 public:
-  static int create_socket(const std::string &ip, const std::string &port);
+  static int create_socket(const std::string &ip, const std::string &port,
+                           const ListenOptions &options);
+
+  static bool is_listen_option(const std::string &token);
+  static bool parse_listen_option(const std::string &token,
+                                  ListenOptions &options);
+
+private:
+  static void apply_listen_options(int sockfd, const ListenOptions &options);
 };
@@ -56,4 +56,6 @@ bool regex_match_posix(const std::string &text, const std::string &pattern, bool
 
 bool is_all_digits(const std::string &str);
 std::string getExtension(const std::string& path);
-std::string get_date();
+
+// socketの相手 (peer) または自分側のaddressとport; 取れなければfalse
+bool get_socket_address(int fd, bool peer, std::string &address, int &port);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <cctype>
 #include <map>
 #include <string>
 #include <vector>
@@ -30,13 +31,18 @@ typedef StrToStrMap::const_iterator ConstStrToStrMapIt;
 
 typedef std::pair<std::string, std::string> ListenPair;
 // HeaderMap
+// 比較のたびに小文字のコピーを作らず、1文字ずつ比べる
 struct CaseInsensitiveLess {
   bool operator()(const std::string &a, const std::string &b) const {
-    std::string lower_a = a;
-    std::string lower_b = b;
-    std::transform(a.begin(), a.end(), lower_a.begin(), ::tolower);
-    std::transform(b.begin(), b.end(), lower_b.begin(), ::tolower);
-    return lower_a < lower_b;
+    const size_t length = std::min(a.size(), b.size());
+    for (size_t i = 0; i < length; ++i) {
+      const int ca = std::tolower(static_cast<unsigned char>(a[i]));
+      const int cb = std::tolower(static_cast<unsigned char>(b[i]));
+      if (ca != cb) {
+        return ca < cb;
+      }
+    }
+    return a.size() < b.size();
   }
 };
 
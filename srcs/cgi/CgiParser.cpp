@@ -1,22 +1,44 @@
 #include "CgiParser.hpp"
 #include "Logger.hpp"
+#include "ObjectPool.hpp"
 #include "Utils.hpp"
 #include <algorithm>
 #include <sstream>
 
 CgiParser::CgiParser()
-    : state_(CGI_PARSE_HEADER), status_code_(200), out_buf_(), headers_(), 
-    body_(), body_size_(0) {}
+    : state_(CGI_PARSE_HEADER), status_code_(200), out_buf_(), headers_(),
+      body_(), body_size_(0), body_received_(0) {}
 
 CgiParser::~CgiParser() {}
 
+void CgiParser::clear() {
+  state_ = CGI_PARSE_HEADER;
+  status_code_ = 200;
+  release_buffer(out_buf_);
+  headers_.clear();
+  release_buffer(body_);
+  body_size_ = 0;
+  body_received_ = 0;
+}
+
 void CgiParser::append(const char *data, size_t length) {
   out_buf_.insert(out_buf_.end(), data, data + length);
 }
 
+// 未処理bufferが空なら、copyせずにdataを引き取る (dataは空になる)
+void CgiParser::append(std::vector<char> &data) {
+  if (out_buf_.empty()) {
+    out_buf_.swap(data);
+  } else {
+    out_buf_.insert(out_buf_.end(), data.begin(), data.end());
+  }
+  data.clear();
+}
+
+// header解析後は、body の到着を待たずに true を返し逐次送信させる
 bool CgiParser::parse(bool eof) {
   LOG_DEBUG_FUNC();
-  if (out_buf_.empty() && !(eof && state_ == CGI_PARSE_CHUNK)) {
+  if (out_buf_.empty() && !eof) {
     return is_done();
   }
   if (state_ == CGI_PARSE_HEADER) {
@@ -31,28 +53,57 @@ bool CgiParser::parse(bool eof) {
   if (eof && state_ == CGI_PARSE_HEADER) {
     set_error_status();
   }
-  return (is_done() || state_ == CGI_PARSE_CHUNK);
+  return (is_done() || is_streaming());
 }
 
 bool CgiParser::is_done() const {
   return (state_ == CGI_PARSE_DONE || state_ == CGI_PARSE_ERROR);
 }
 
+bool CgiParser::has_error() const { return state_ == CGI_PARSE_ERROR; }
+
+bool CgiParser::is_streaming() const {
+  return (state_ == CGI_PARSE_BODY || state_ == CGI_PARSE_CHUNK);
+}
+
+size_t CgiParser::buffered_size() const {
+  return out_buf_.size() + body_.size();
+}
+
+// Content-Length の body を受信中で、未処理のbufferがない状態
+bool CgiParser::is_passthrough() const {
+  return (state_ == CGI_PARSE_BODY && buffered_size() == 0 &&
+          body_received_ < body_size_);
+}
+
+size_t CgiParser::get_remaining_body() const {
+  return body_size_ - body_received_;
+}
+
+// parserを経由せずにclientへ送られたbodyの分だけ進める
+void CgiParser::consume_relayed(size_t length) {
+  body_received_ += std::min(length, get_remaining_body());
+  if (body_received_ == body_size_) {
+    state_ = CGI_PARSE_DONE;
+  }
+}
+
 int CgiParser::get_status_code() const { return status_code_; }
 
-const std::vector<std::pair<std::string, std::string> > &
-CgiParser::get_parsed_headers() const {
-  return headers_;
+// headerはparse_headers()の後は参照しないので、copyせずに渡す
+void CgiParser::take_headers(
+    std::vector<std::pair<std::string, std::string> > &out) {
+  out.swap(headers_);
+  headers_.clear();
 }
 
-std::vector<char> CgiParser::take_body() {
-  std::vector<char> temp;
-  temp.swap(body_); // body_ を空にして temp に入れる
-  return temp;
+// body_ を空にして out に入れる (outの古い中身は捨てる)
+void CgiParser::take_body(std::vector<char> &out) {
+  out.swap(body_);
+  body_.clear();
 }
 
 static const int k_max_cgi_header_size = 8192;
-static const size_t k_max_cgi_body = 1048576;
 
 void CgiParser::parse_headers() {
 
@@ -89,7 +140,7 @@ void CgiParser::parse_headers() {
 
   while (std::getline(iss, line) && !line.empty()) {
     if (!parse_header_line(line)) {
-      log(LOG_DEBUG, "Failed to parse CGI header line: " + line);
+      LOG(LOG_DEBUG, "Failed to parse CGI header line: " + line);
       set_error_status();
       return;
     }
@@ -116,11 +167,6 @@ void CgiParser::parse_headers() {
     }
 
     body_size_ = static_cast<size_t>(tmp_size);
-    if (body_size_ > k_max_cgi_body) {
-      set_error_status();
-      return;
-    }
-
     state_ = CGI_PARSE_BODY;
   } else {
     set_header("Transfer-Encoding", "chunked");
@@ -133,13 +179,13 @@ static const int k_max_cgi_header_line = 1000;
 bool CgiParser::parse_header_line(std::string &line) {
 
   if (line.size() > k_max_cgi_header_line || std::isspace(line[0])) {
-    log(LOG_ERROR, "Invalid cgi header field: " + line);
+    LOG(LOG_ERROR, "Invalid cgi header field: " + line);
     return false;
   }
 
   size_t pos = line.find(":");
   if (pos == std::string::npos || pos == 0) {
-    log(LOG_ERROR, "Failed to parse cgi header line: " + line);
+    LOG(LOG_ERROR, "Failed to parse cgi header line: " + line);
     return false;
   }
 
@@ -148,7 +194,7 @@ bool CgiParser::parse_header_line(std::string &line) {
 
   for (size_t i = 0; i < key.size(); ++i) {
     if (!is_valid_field_name_char(key[i])) {
-      log(LOG_ERROR, "Invalid character in cgi field-name: " + line);
+      LOG(LOG_ERROR, "Invalid character in cgi field-name: " + line);
       return false;
     }
   }
@@ -167,23 +213,28 @@ bool CgiParser::parse_header_line(std::string &line) {
   return true;
 }
 
+// Content-Length 付きの body も、受信済みの分から body_ に移して逐次送信する
 void CgiParser::parse_body(bool eof) {
-  if (body_size_ == 0) {
-    state_ = CGI_PARSE_DONE;
-    return;
+  size_t remaining = body_size_ - body_received_;
+  size_t n = std::min(out_buf_.size(), remaining);
+
+  if (n > 0 && body_.empty() && n == out_buf_.size()) {
+    body_.swap(out_buf_); // 全てbodyなら、copyせずにbufferごと移す
+    body_received_ += n;
+  } else if (n > 0) {
+    body_.insert(body_.end(), out_buf_.begin(), out_buf_.begin() + n);
+    out_buf_.erase(out_buf_.begin(), out_buf_.begin() + n);
+    body_received_ += n;
   }
-  if (out_buf_.size() < body_size_) {
+  if (body_received_ < body_size_) {
     if (eof) {
       set_error_status();
     }
-    return; // body未受信　
+    return; // body未受信
   }
-
-  if (out_buf_.size() > body_size_) {
-    log(LOG_WARNING, "CGI output exceeds declared Content-Length");
+  if (!out_buf_.empty()) {
+    LOG(LOG_WARNING, "CGI output exceeds declared Content-Length");
   }
-  body_ = std::vector<char>(out_buf_.begin(), out_buf_.begin() + body_size_);
-  out_buf_.erase(out_buf_.begin(), out_buf_.begin() + body_size_);
   state_ = CGI_PARSE_DONE;
 }
 
@@ -195,7 +246,11 @@ void CgiParser::parse_chunked_body(bool eof) {
     return;
   }
 
-  body_.insert(body_.end(), out_buf_.begin(), out_buf_.end());
+  if (body_.empty()) {
+    body_.swap(out_buf_);
+  } else {
+    body_.insert(body_.end(), out_buf_.begin(), out_buf_.end());
+  }
   out_buf_.clear(); // 移行済みのbufferを初期化
   if (eof) {
     state_ = CGI_PARSE_DONE;
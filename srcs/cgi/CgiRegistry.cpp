@@ -19,7 +19,7 @@ CgiRegistry::~CgiRegistry() {
 
 void CgiRegistry::add(int fd, CgiSession *session) {
   if (has(fd)) {
-    logfd(LOG_ERROR, "Duplicate cgi fd: ", fd);
+    LOG_FD(LOG_ERROR, "Duplicate cgi fd: ", fd);
     return;
   }
   fd_to_cgis_[fd] = session;
@@ -39,14 +39,14 @@ void CgiRegistry::remove(int fd) {
   fd_to_cgis_.erase(it);
   if (!session->is_client_alive() &&
       fd_to_cgis_.count(stdin_fd) + fd_to_cgis_.count(stdout_fd) == 0) {
-    delete session;
+    CgiSession::release(session);
   }
 }
 
 CgiSession *CgiRegistry::get(int fd) const {
   ConstCgiIt it = fd_to_cgis_.find(fd);
   if (it == fd_to_cgis_.end()) {
-    logfd(LOG_ERROR, "Failed to find cgi fd: ", fd);
+    LOG_FD(LOG_ERROR, "Failed to find cgi fd: ", fd);
     return NULL;
   }
   return it->second;
@@ -56,6 +56,24 @@ bool CgiRegistry::has(int fd) const {
   return fd_to_cgis_.find(fd) != fd_to_cgis_.end();
 }
 
+size_t CgiRegistry::get_session_count() const {
+  std::set<CgiSession *> sessions;
+  for (ConstCgiIt it = fd_to_cgis_.begin(); it != fd_to_cgis_.end(); ++it) {
+    sessions.insert(it->second);
+  }
+  return sessions.size();
+}
+
+// fdを監視中のsessionから探す; 見つからなければNULL
+CgiSession *CgiRegistry::find_by_pid(pid_t pid) const {
+  for (ConstCgiIt it = fd_to_cgis_.begin(); it != fd_to_cgis_.end(); ++it) {
+    if (it->second->get_pid() == pid) {
+      return it->second;
+    }
+  }
+  return NULL;
+}
+
 std::set<int> CgiRegistry::mark_timed_outs() {
   std::set<int> client_fds;
   std::set<CgiSession *> cgi_sessions;
@@ -68,10 +86,11 @@ std::set<int> CgiRegistry::mark_timed_outs() {
   }
   for (CgiSetIt it = cgi_sessions.begin(); it != cgi_sessions.end(); ++it) {
     CgiSession *session = *it;
-    session->on_cgi_timeout(); // fd close; pid SIGTERM; delete if Client dead
+    // on_cgi_timeout() の後はsessionがpoolに戻っている場合がある
     if (session->is_client_alive()) {
       client_fds.insert(session->get_client_fd());
     }
+    session->on_cgi_timeout(); // fd close; pid SIGTERM; release if Client dead
   }
   return client_fds;
 }
@@ -1,6 +1,7 @@
 #include "CgiResponseBuilder.hpp"
 #include "CgiParser.hpp"
 #include "HttpResponse.hpp"
+#include "ObjectPool.hpp"
 #include "Utils.hpp"
 #include <sstream>
 #include <vector>
@@ -11,10 +12,23 @@ CgiResponseBuilder::CgiResponseBuilder()
 
 CgiResponseBuilder::~CgiResponseBuilder() {}
 
+void CgiResponseBuilder::clear() {
+  status_code_ = 0;
+  headers_.clear();
+  release_buffer(body_);
+  conn_policy_ = CP_KEEP_ALIVE;
+  is_chunked_ = false;
+  is_header_sent_ = false;
+  is_response_sent_ = false;
+}
+
 void CgiResponseBuilder::apply(CgiParser &parser) {
   status_code_ = parser.get_status_code();
-  headers_ = parser.get_parsed_headers();
-  body_ = parser.take_body();
+  // headerは解析直後の1回だけ受け取る; 以降のapplyではbodyだけを移す
+  if (!is_header_sent_ && headers_.empty()) {
+    parser.take_headers(headers_);
+  }
+  parser.take_body(body_);
 
   // Transfer-Encoding: chunked があれば chunk ON
   is_chunked_ = false;
@@ -31,50 +45,68 @@ void CgiResponseBuilder::set_connection_policy(ConnectionPolicy policy) {
   conn_policy_ = policy;
 }
 
-void CgiResponseBuilder::build_response(HttpResponse &response, bool eof) {
+// header 解析後は EOF を待たずに送信する
+// Content-Length あり: header -> body を受信した分だけ素通しで送る
+// Content-Length なし: chunked で送る (CgiParser が Transfer-Encoding を付与)
+void CgiResponseBuilder::build_response(HttpResponse &response, bool done) {
   if (is_response_sent_) {
-    log(LOG_WARNING, "CgiResponseBuilder: attempt to send duplicate response");
+    LOG(LOG_WARNING, "CgiResponseBuilder: attempt to send duplicate response");
     return;
   }
   if (status_code_ == 500) {
-    response.generate_error_response(500, conn_policy_);
-    is_response_sent_ = true;
+    build_error_response(response, 500);
     return;
   }
 
-  if (is_chunked_) {
-    if (!is_header_sent_) {
+  if (!is_header_sent_) {
+    if (!is_chunked_ && done) {
+      // 初回で全て揃っている場合は、1つのレスポンスにまとめる
+      response.generate_response(status_code_, headers_, body_, conn_policy_);
+      body_.clear();
+      is_response_sent_ = true;
+      return;
+    }
+    if (is_chunked_) {
       response.generate_chunk_response_header(status_code_, headers_,
                                               conn_policy_);
-      is_header_sent_ = true;
+    } else {
+      response.generate_response_header(status_code_, headers_, conn_policy_);
     }
+    is_header_sent_ = true;
+  }
+
+  if (is_chunked_) {
     if (!body_.empty()) {
       response.generate_chunk_response_body(body_);
       body_.clear();
     }
-    if (eof) {
+    if (done) {
       response.generate_chunk_response_last(conn_policy_);
       is_response_sent_ = true;
     }
-  } else {
-    response.generate_response(status_code_, headers_, body_, conn_policy_);
+    return;
+  }
+
+  // NOTE: 最後の body 断片にだけ接続の終了判断を載せる
+  if (!body_.empty()) {
+    response.generate_response_body(body_, done ? conn_policy_
+                                                : CP_KEEP_ALIVE);
+    body_.clear();
+  } else if (done && conn_policy_ != CP_KEEP_ALIVE) {
+    response.generate_connection_close(conn_policy_);
+  }
+  if (done) {
     is_response_sent_ = true;
   }
 }
 
 void CgiResponseBuilder::build_error_response(HttpResponse &response,
                                               int status_code) {
-  if (is_response_sent_) {
-    return;
-  }
-  if (is_chunked_ && is_header_sent_) {
-    response.generate_chunk_response_last(conn_policy_);
-  } else {
-    response.generate_error_response(status_code, conn_policy_);
-  }
-  is_response_sent_ = true;
+  build_error_response(response, status_code, conn_policy_);
 }
 
+// header 送信後は status を変更できないので、
+// chunked なら終端を送り, Content-Length の途中なら接続を閉じる
 void CgiResponseBuilder::build_error_response(HttpResponse &response,
                                               int status_code,
                                               ConnectionPolicy policy) {
@@ -83,6 +115,8 @@ void CgiResponseBuilder::build_error_response(HttpResponse &response,
   }
   if (is_chunked_ && is_header_sent_) {
     response.generate_chunk_response_last(policy);
+  } else if (is_header_sent_) {
+    response.generate_connection_close(CP_MUST_CLOSE);
   } else {
     response.generate_error_response(status_code, policy);
   }
@@ -90,3 +124,5 @@ void CgiResponseBuilder::build_error_response(HttpResponse &response,
 }
 
 bool CgiResponseBuilder::is_sent() const { return is_response_sent_; }
+
+bool CgiResponseBuilder::is_header_sent() const { return is_header_sent_; }
@@ -1,25 +1,88 @@
 #include "CgiSession.hpp"
+#include "CgiUtils.hpp"
+#include "FastCgiPool.hpp"
+#include "HttpResponse.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
 #include "Multiplexer.hpp"
+#include "ObjectPool.hpp"
+#include <cerrno>
 #include <iostream>
 #include <signal.h>
+#include <sstream>
+#include <spawn.h>
 
 static const int k_timeout_sec = 10;
 
+// Clientへの送信待ちがこの量を超えたらCGI出力の読み込みを止め、
+// low watermarkまで捌けたら再開する
+static const size_t k_read_high_watermark = 262144;
+static const size_t k_read_low_watermark = 65536;
+
+// pipe容量(Linux既定 64KiB)に合わせ、1回のreadでpipeを空にできる大きさ
+static const size_t k_read_buf_size = 65536;
+
+// 1接続で同時に扱うrequestは1つなので、request idは固定
+static const unsigned short k_fastcgi_request_id = 1;
+
 CgiSession::CgiSession(int client_fd)
     : parser_(), builder_(), client_fd_(client_fd), state_(CGI_IDLE), pid_(-1),
       stdin_fd_(-1), stdout_fd_(-1), in_buf_(), in_off_(0),
-      cgi_last_activity_(time(NULL)), client_alive_(true) {
-  log(LOG_DEBUG, "CGI constructor called");
+      cgi_last_activity_(time(NULL)), started_at_(), client_alive_(true),
+      read_paused_(false), client_queued_bytes_(0), splice_enabled_(true),
+      relayed_bytes_(0), is_fastcgi_(false), fastcgi_address_(),
+      record_parser_() {
+  LOG(LOG_DEBUG, "CGI constructor called");
 }
 
 // forkしたプロセスとCGI fdのclean up責務はCgiSession
 CgiSession::~CgiSession() {
-  if (pid_ != -1 && waitpid(pid_, NULL, WNOHANG) == 0) {
-    kill(pid_, SIGKILL);
-    // 回収はsignal(SIGCHLD, handle_sigchld);が動作する
+  kill_child();
+  terminate_cgi_fds();
+}
+
+// poolに待機中のsessionがあれば再利用し、なければnewする
+CgiSession *CgiSession::create(int client_fd) {
+  CgiSession *session = ObjectPool<CgiSession>::get_instance().acquire();
+  if (!session) {
+    return new CgiSession(client_fd);
   }
+  session->client_fd_ = client_fd;
+  session->cgi_last_activity_ = time(NULL);
+  return session;
+}
+
+// deleteの代わり; 上限を超えていなければrecycle()してpoolに戻す
+void CgiSession::release(CgiSession *session) {
+  ObjectPool<CgiSession>::get_instance().release(session);
+}
+
+// destructorと同じ後始末をし、bufferの容量を残して初期状態に戻す
+void CgiSession::recycle() {
+  kill_child();
   terminate_cgi_fds();
+  parser_.clear();
+  builder_.clear();
+  client_fd_ = -1;
+  state_ = CGI_IDLE;
+  pid_ = -1;
+  stdin_fd_ = -1;
+  stdout_fd_ = -1;
+  release_buffer(in_buf_);
+  in_off_ = 0;
+  client_alive_ = true;
+  read_paused_ = false;
+  client_queued_bytes_ = 0;
+  splice_enabled_ = true;
+  relayed_bytes_ = 0;
+  is_fastcgi_ = false;
+  fastcgi_address_.clear();
+  record_parser_.clear();
+}
+
+bool CgiSession::is_idle() const {
+  return state_ == CGI_IDLE && client_fd_ == -1 && pid_ == -1 &&
+         stdin_fd_ == -1 && stdout_fd_ == -1;
 }
 
 int CgiSession::get_stdin_fd() const { return stdin_fd_; }
@@ -52,21 +115,49 @@ bool CgiSession::is_cgi_timeout(time_t now) const {
   if (state_ == CGI_IDLE || state_ == CGI_ERROR) {
     return false;
   }
+  // 読み込み抑制中の停滞はClient側のtimeoutで扱う
+  if (read_paused_ && client_alive_ && state_ != CGI_TIMED_OUT) {
+    return false;
+  }
   return (state_ == CGI_TIMED_OUT || now - cgi_last_activity_ > k_timeout_sec);
 }
 
+static void close_pipes(int input_pipe[2], int output_pipe[2]) {
+  close(input_pipe[0]);
+  close(input_pipe[1]);
+  close(output_pipe[0]);
+  close(output_pipe[1]);
+}
+
+// 後から起動する別のCGIにpipeを引き継がせない
+// (子のstdin/stdoutはdup2で複製されるので、CLOEXECは外れる)
+static bool set_cloexec(int input_pipe[2], int output_pipe[2]) {
+  return (fcntl(input_pipe[0], F_SETFD, FD_CLOEXEC) != -1 &&
+          fcntl(input_pipe[1], F_SETFD, FD_CLOEXEC) != -1 &&
+          fcntl(output_pipe[0], F_SETFD, FD_CLOEXEC) != -1 &&
+          fcntl(output_pipe[1], F_SETFD, FD_CLOEXEC) != -1);
+}
+
 void CgiSession::handle_cgi_request(HttpRequest &request,
                                     const std::string &cgi_path) {
   LOG_DEBUG_FUNC();
   int input_pipe[2];
   int output_pipe[2];
-  const std::string &method = request.get_method();
-  const std::string &target = request.get_path();
 
   builder_.set_connection_policy(request.get_connection_policy());
   in_buf_ = request.get_body();
   in_off_ = 0;
 
+  // argvとenvpは親で組み立て、子はdup2とexecveだけを行う
+  std::vector<std::string> env = CgiUtils::build_cgi_env(request, cgi_path);
+  std::vector<char *> envp;
+  envp.reserve(env.size() + 1);
+  for (size_t i = 0; i < env.size(); ++i) {
+    envp.push_back(const_cast<char *>(env[i].c_str()));
+  }
+  envp.push_back(NULL);
+  char *argv[] = {const_cast<char *>(cgi_path.c_str()), NULL};
+
   if (pipe(input_pipe) == -1) {
     throw std::runtime_error("pipe failed: " + std::string(strerror(errno)));
   }
@@ -75,78 +166,103 @@ void CgiSession::handle_cgi_request(HttpRequest &request,
     close(input_pipe[1]);
     throw std::runtime_error("pipe failed: " + std::string(strerror(errno)));
   }
-
-  pid_ = fork();
-  if (pid_ < 0) {
-    close(input_pipe[0]);
-    close(input_pipe[1]);
-    close(output_pipe[0]);
-    close(output_pipe[1]);
-    throw std::runtime_error("fork failed: " + std::string(strerror(errno)));
+  if (!set_cloexec(input_pipe, output_pipe)) {
+    close_pipes(input_pipe, output_pipe);
+    throw std::runtime_error("fcntl failed: " + std::string(strerror(errno)));
   }
 
-  if (pid_ == 0) {
-
-    // 標準入出力のリダイレクト
-    dup2(input_pipe[0], STDIN_FILENO);
-    dup2(output_pipe[1], STDOUT_FILENO);
-
-    // 不要なfdを全て閉じる
-    close(input_pipe[0]);
-    close(input_pipe[1]);
-    close(output_pipe[0]);
-    close(output_pipe[1]);
-
-    // 環境変数の設定
-    std::string contentLength = request.get_header_value("Content-Length");
-    std::string contentLengthStr = "CONTENT_LENGTH=" + contentLength;
-    std::string requestMethodStr = "REQUEST_METHOD=" + method;
-    std::string contentTypeStr =
-        "CONTENT_TYPE=" + request.get_header_value("Content-Type");
-    std::string queryString = "QUERY_STRING=";
-
-    if (method == "GET") {
-      size_t pos = target.find('?');
-      if (pos != std::string::npos) {
-        queryString += target.substr(pos + 1);
-      }
-    }
-
-    char *envp[] = {const_cast<char *>(requestMethodStr.c_str()),
-                    const_cast<char *>(contentLengthStr.c_str()),
-                    const_cast<char *>(contentTypeStr.c_str()),
-                    const_cast<char *>(queryString.c_str()), NULL};
+  // forkと違い、serverのページテーブルを複製しない (glibcではCLONE_VFORK)
+  // SIGCHLDはsignalfdのためにblockしているので、CGIには空のmaskを渡す
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t empty_mask;
+  sigemptyset(&empty_mask);
+  int err = posix_spawn_file_actions_init(&actions);
+  if (err == 0) {
+    err = posix_spawnattr_init(&attr);
+  }
+  if (err == 0) {
+    err = posix_spawnattr_setsigmask(&attr, &empty_mask);
+  }
+  if (err == 0) {
+    err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+  }
+  if (err == 0) {
+    err = posix_spawn_file_actions_adddup2(&actions, input_pipe[0],
+                                           STDIN_FILENO);
+  }
+  if (err == 0) {
+    err = posix_spawn_file_actions_adddup2(&actions, output_pipe[1],
+                                           STDOUT_FILENO);
+  }
+  if (err == 0) {
+    SlowOpScope op("spawn_cgi");
+    err = posix_spawn(&pid_, cgi_path.c_str(), &actions, &attr, argv,
+                      &envp[0]);
+  }
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0) {
+    pid_ = -1;
+    close_pipes(input_pipe, output_pipe);
+    throw std::runtime_error("posix_spawn failed: " +
+                             std::string(strerror(err)));
+  }
+  gettimeofday(&started_at_, NULL);
+
+  // 親プロセスで使わないpipeを閉じる
+  close(input_pipe[0]);
+  close(output_pipe[1]);
+
+  // Multiplexerに登録するfdを設定
+  stdin_fd_ = input_pipe[1];
+  stdout_fd_ = output_pipe[0];
+
+  // pipeのfd（親側）をnon blockingにする
+  if (fcntl(stdin_fd_, F_SETFL, fcntl(stdin_fd_, F_GETFL) | O_NONBLOCK) ==
+          -1 ||
+      fcntl(stdout_fd_, F_SETFL, fcntl(stdout_fd_, F_GETFL) | O_NONBLOCK) ==
+          -1) {
+    close(stdin_fd_);
+    close(stdout_fd_);
+    throw std::runtime_error("fcntl failed: " + std::string(strerror(errno)));
+  }
+  start_pipe_io();
+}
 
-    char *argv[] = {const_cast<char *>(cgi_path.c_str()), NULL};
+// ClientRegistryに登録し、stdin_fd_の監視を開始する
+void CgiSession::start_pipe_io() {
+  Multiplexer &multiplexer = Multiplexer::get_instance();
+  multiplexer.register_cgi_fd(stdin_fd_, this);
+  multiplexer.monitor_pipe_write(stdin_fd_);
+  state_ = CGI_WRITING;
+}
 
-    execve(cgi_path.c_str(), argv, envp);
-    log(LOG_ERROR, "execve failed");
-    std::exit(1);
-  } else {
-    // 親プロセスで使わないpipeを閉じる
-    close(input_pipe[0]);
-    close(output_pipe[1]);
-
-    // Multiplexerに登録するfdを設定
-    stdin_fd_ = input_pipe[1];
-    stdout_fd_ = output_pipe[0];
-
-    // pipeのfd（親側）をnon blockingにする
-    if (fcntl(stdin_fd_, F_SETFL, fcntl(stdin_fd_, F_GETFL) | O_NONBLOCK) ==
-            -1 ||
-        fcntl(stdout_fd_, F_SETFL, fcntl(stdout_fd_, F_GETFL) | O_NONBLOCK) ==
-            -1) {
-      close(stdin_fd_);
-      close(stdout_fd_);
-      throw std::runtime_error("fcntl failed: " + std::string(strerror(errno)));
-    }
+// fork せず、FastCGI server との接続 (stdin/stdout 兼用) にrequestを送る
+void CgiSession::handle_fastcgi_request(HttpRequest &request,
+                                        const std::string &address,
+                                        const std::string &script_path) {
+  LOG_DEBUG_FUNC();
+  builder_.set_connection_policy(request.get_connection_policy());
+  is_fastcgi_ = true;
+  splice_enabled_ = false; // STDOUT はrecordに包まれているので素通しできない
+  fastcgi_address_ = address;
 
-    // ClientRegistryに登録し、stdin_fd_の監視を開始する
-    Multiplexer &multiplexer = Multiplexer::get_instance();
-    multiplexer.register_cgi_fd(stdin_fd_, this);
-    multiplexer.monitor_pipe_write(stdin_fd_);
-    state_ = CGI_WRITING;
+  int fd = FastCgiPool::get_instance().acquire(address);
+  if (fd == -1) {
+    throw std::runtime_error("fastcgi_pass unavailable: " + address);
   }
+  in_buf_ = FastCgiUtils::encode_request(
+      k_fastcgi_request_id, CgiUtils::build_cgi_params(request, script_path),
+      request.get_body(), true);
+  in_off_ = 0;
+  stdin_fd_ = fd;
+  stdout_fd_ = fd;
+
+  Multiplexer &multiplexer = Multiplexer::get_instance();
+  multiplexer.register_cgi_fd(fd, this);
+  multiplexer.monitor_pipe_write(fd);
+  state_ = CGI_WRITING;
 }
 
 // Client::on_write() -> HttpTransaction -> で呼ばれる関数
@@ -162,7 +278,29 @@ void CgiSession::build_response(HttpResponse &response) {
   if (parser_.parse(eof) && !builder_.is_sent()) {
     // なにか送るものがある
     builder_.apply(parser_);
-    builder_.build_response(response, eof);
+    builder_.build_response(response, parser_.is_done());
+  }
+  update_read_throttle(response.get_queued_bytes());
+}
+
+// Clientへの送信が詰まっている間は、CGI stdoutの監視を外して読み込みを止める
+void CgiSession::update_read_throttle(size_t queued_bytes) {
+  client_queued_bytes_ = queued_bytes;
+  if (state_ != CGI_READING || stdout_fd_ == -1) {
+    return;
+  }
+  size_t backlog = queued_bytes + parser_.buffered_size();
+  Multiplexer &multiplexer = Multiplexer::get_instance();
+
+  if (!read_paused_ && backlog >= k_read_high_watermark) {
+    LOG_FD(LOG_DEBUG, "Pause reading CGI stdout fd: ", stdout_fd_);
+    multiplexer.unmonitor_pipe_read(stdout_fd_);
+    read_paused_ = true;
+  } else if (read_paused_ && backlog <= k_read_low_watermark) {
+    LOG_FD(LOG_DEBUG, "Resume reading CGI stdout fd: ", stdout_fd_);
+    multiplexer.monitor_pipe_read(stdout_fd_);
+    read_paused_ = false;
+    update_cgi_activity();
   }
 }
 
@@ -174,11 +312,13 @@ void CgiSession::build_error_response(HttpResponse &response, int status_code,
 
 void CgiSession::close_fd(int fd) {
   if (fd == -1 || (fd != stdin_fd_ && fd != stdout_fd_)) {
-    logfd(LOG_WARNING, "Invalid CGI fd to close: ", fd);
+    LOG_FD(LOG_WARNING, "Invalid CGI fd to close: ", fd);
     return;
   }
-  if (close(fd) == -1) {
-    logfd(LOG_WARNING, "Failed to close cgi fd: ", fd);
+  if (is_fastcgi_ && state_ == CGI_EOF && record_parser_.is_reusable()) {
+    FastCgiPool::get_instance().release(fastcgi_address_, fd);
+  } else if (close(fd) == -1) {
+    LOG_FD(LOG_WARNING, "Failed to close cgi fd: ", fd);
   }
   if (fd == stdin_fd_) {
     stdin_fd_ = -1;
@@ -220,9 +360,14 @@ CgiIOStatus CgiSession::on_cgi_read() {
   if (!is_processing()) {
     return CGI_IO_ERROR;
   }
-  const int buf_size = 1024;
-  char buffer[buf_size];
-  ssize_t bytes_read = read(stdout_fd_, buffer, buf_size);
+  if (read_paused_) {
+    return CGI_IO_CONTINUE; // 監視解除前に取得済みのeventは読み捨てない
+  }
+  if (can_splice()) {
+    return relay_by_splice();
+  }
+  static char buffer[k_read_buf_size];
+  ssize_t bytes_read = read(stdout_fd_, buffer, k_read_buf_size);
   if (bytes_read == -1) {
     state_ = CGI_ERROR;
     terminate_pid();
@@ -233,10 +378,80 @@ CgiIOStatus CgiSession::on_cgi_read() {
     state_ = CGI_EOF;
     return CGI_IO_READ_COMPLETE;
   }
+  if (is_fastcgi_) {
+    return on_fastcgi_read(buffer, bytes_read);
+  }
   parser_.append(buffer, bytes_read);
+  update_read_throttle(client_queued_bytes_);
+  return CGI_IO_CONTINUE;
+}
+
+// STDOUT recordの中身だけをCgiParserに渡し、END_REQUEST をEOFとして扱う
+CgiIOStatus CgiSession::on_fastcgi_read(const char *data, size_t length) {
+  std::vector<char> stdout_data;
+
+  record_parser_.append(data, length);
+  record_parser_.parse(stdout_data);
+  if (!stdout_data.empty()) {
+    parser_.append(stdout_data);
+  }
+  if (record_parser_.is_ended()) {
+    state_ = CGI_EOF;
+    return CGI_IO_READ_COMPLETE;
+  }
+  update_read_throttle(client_queued_bytes_);
   return CGI_IO_CONTINUE;
 }
 
+// header送信済みで、Content-Length の body を加工せず素通しする段階か
+bool CgiSession::can_splice() const {
+#if defined(__linux__)
+  return (splice_enabled_ && client_alive_ && parser_.is_passthrough() &&
+          builder_.is_header_sent() && client_queued_bytes_ == 0);
+#else
+  return false;
+#endif
+}
+
+// CGI stdout の pipe から client socket へ、user空間にコピーせず直接移す
+CgiIOStatus CgiSession::relay_by_splice() {
+#if defined(__linux__)
+  ssize_t bytes_moved =
+      splice(stdout_fd_, NULL, client_fd_, NULL, parser_.get_remaining_body(),
+             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (bytes_moved == -1) {
+    // socketの送信bufferが詰まっている; client writableまで待つ
+    if (errno == EAGAIN) {
+      Multiplexer::get_instance().unmonitor_pipe_read(stdout_fd_);
+      read_paused_ = true;
+      return CGI_IO_CONTINUE;
+    }
+    // clientが切断済み; 接続ごと閉じさせる (sessionはその後始末で解放される)
+    if (errno == EPIPE || errno == ECONNRESET) {
+      state_ = CGI_ERROR;
+      terminate_pid();
+      return CGI_IO_SHOULD_CLOSE;
+    }
+    // EINVAL, ENOSYS など: このfdの組では splice を諦めて read に戻す
+    LOG_FD(LOG_DEBUG, "splice unavailable, fallback to read on fd: ",
+           stdout_fd_);
+    splice_enabled_ = false;
+    return CGI_IO_CONTINUE;
+  }
+  update_cgi_activity();
+  if (bytes_moved == 0) {
+    state_ = CGI_EOF;
+    return CGI_IO_READ_COMPLETE;
+  }
+  parser_.consume_relayed(bytes_moved);
+  relayed_bytes_ += bytes_moved;
+  Metrics::get_instance().count_bytes_out(bytes_moved);
+  return CGI_IO_RELAYED;
+#else
+  return CGI_IO_CONTINUE;
+#endif
+}
+
 void CgiSession::on_cgi_timeout() {
   if (is_terminal_state()) {
     return;
@@ -247,6 +462,79 @@ void CgiSession::on_cgi_timeout() {
   terminate_cgi_fds();
 }
 
+// 子processが終了した (waitpid済み)。異常終了で、まだheaderを送っていなければ
+// pipeに残っている出力を読み、正しい応答になっていなければ
+// pipeのEOFを待たずに失敗として扱う; trueならClientにerror応答を返させる
+bool CgiSession::on_cgi_exit(int status) {
+  log_exit(pid_, status, &started_at_);
+  pid_ = -1; // 回収済み; pidの再利用に備えてkillの対象から外す
+
+  bool exited_ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (exited_ok || !is_processing() || builder_.is_header_sent()) {
+    return false; // 出力はpipeのEOFまで通常どおり読む
+  }
+  // 終了の通知がpipeのreadableより先に届くことがあるので、残りを読んでから判断する
+  bool eof = (!is_fastcgi_ && stdout_fd_ != -1 && !read_paused_)
+                 ? drain_stdout()
+                 : false;
+  if (parser_.parse(eof) && !parser_.has_error()) {
+    return false; // 応答は正しい; 残りとEOFは通常どおりpipeから読む
+  }
+  state_ = CGI_ERROR;
+  terminate_cgi_fds();
+  return true;
+}
+
+// 正常終了はINFO、0以外の終了やsignalによる終了はWARNING
+void CgiSession::log_exit(pid_t pid, int status,
+                          const struct timeval *started_at) {
+  bool exited_ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  LogLevel level = exited_ok ? LOG_INFO : LOG_WARNING;
+  if (!is_log_enabled(level)) {
+    return;
+  }
+  std::ostringstream oss;
+  oss << "CGI pid " << pid << " exited with status "
+      << (WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status));
+  if (started_at) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    oss << " after "
+        << (now.tv_sec - started_at->tv_sec) * 1000 +
+               (now.tv_usec - started_at->tv_usec) / 1000
+        << " ms";
+  }
+  log(level, oss.str());
+}
+
+// 読めるだけ読んでparserに積む; EOFまで読めたらtrue
+// (子は終了済みなので、残りはpipeの容量ぶんまで; 孫processが書き続ける場合に備えて上限を置く)
+bool CgiSession::drain_stdout() {
+  static char buffer[k_read_buf_size];
+  size_t drained = 0;
+  ssize_t bytes_read = -1;
+  while (drained < k_read_high_watermark &&
+         (bytes_read = read(stdout_fd_, buffer, k_read_buf_size)) > 0) {
+    parser_.append(buffer, bytes_read);
+    drained += bytes_read;
+  }
+  return bytes_read == 0;
+}
+
+// 終了済みの子はWNOWAITで回収せずに残し、終了statusをreap_children()に渡す
+void CgiSession::kill_child() {
+  if (pid_ == -1) {
+    return;
+  }
+  siginfo_t info;
+  info.si_pid = 0;
+  if (waitid(P_PID, pid_, &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+      info.si_pid == 0) {
+    kill(pid_, SIGKILL);
+    // 回収はMultiplexer::reap_children()が行う
+  }
+}
+
 void CgiSession::terminate_pid() {
   if (pid_ == -1) {
     return;
@@ -257,6 +545,9 @@ void CgiSession::terminate_pid() {
 
 void CgiSession::terminate_cgi_fds() {
   LOG_DEBUG_FUNC();
+  if (stdin_fd_ == -1 && stdout_fd_ == -1) {
+    return; // pool待機中など; 終了時にMultiplexerを作り直さない
+  }
 
   Multiplexer &multiplexer = Multiplexer::get_instance();
 
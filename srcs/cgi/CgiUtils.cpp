@@ -1,5 +1,8 @@
 #include "CgiUtils.hpp"
+#include "HttpRequest.hpp"
 #include "Utils.hpp"
+#include <sstream>
+#include <strings.h>
 
 namespace CgiUtils {
 bool is_cgi_request(
@@ -33,4 +36,107 @@ bool is_cgi_like_path(const std::string& path) {
     return false;
 }
 
+bool is_location_has_fastcgi(const ConfigMap &best_match_config) {
+  ConstConfigIt it = best_match_config.find("fastcgi_pass");
+  return (it != best_match_config.end() && !it->second.empty());
+}
+
+// HTTP_* として渡さないheader
+// - Proxy: HTTP_PROXY として渡すとscriptのproxy設定を書き換えられる (httpoxy)
+// - Content-Type, Content-Length: CONTENT_TYPE, CONTENT_LENGTH で渡す
+static bool is_excluded_header(const std::string &name) {
+  static const char *excluded[] = {"proxy", "content-type", "content-length"};
+  for (size_t i = 0; i < sizeof(excluded) / sizeof(*excluded); ++i) {
+    if (strcasecmp(name.c_str(), excluded[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+// SERVER_NAME: server_name の先頭, なければHostのhost部, それもなければaddress
+static std::string get_server_name(const HttpRequest &request,
+                                   const std::string &local_address) {
+  if (request.server_config_) {
+    ConstConfigIt it = request.server_config_->find("server_name");
+    if (it != request.server_config_->end() && !it->second.empty())
+      return it->second[0];
+  }
+  const std::string &host = request.get_header_value("Host");
+  if (!host.empty() && host[0] != '[')
+    return host.substr(0, host.find(':'));
+  if (!host.empty())
+    return host.substr(0, host.find(']') + 1);
+  return local_address;
+}
+
+// CGI/1.1 のメタ変数 (RFC3875 4.1) と HTTP_* ヘッダを組み立てる
+std::vector<std::pair<std::string, std::string> >
+build_cgi_params(const HttpRequest &request, const std::string &script_path) {
+  typedef std::pair<std::string, std::string> Param;
+  std::vector<Param> params;
+  const std::string &target = request.get_path();
+  size_t qpos = target.find('?');
+  std::ostringstream content_length;
+  std::ostringstream server_port;
+  std::string local_address;
+  std::string remote_address;
+  int local_port = 0;
+  int remote_port = 0;
+
+  get_socket_address(request.get_client_fd(), false, local_address,
+                     local_port);
+  get_socket_address(request.get_client_fd(), true, remote_address,
+                     remote_port);
+  content_length << request.get_body().size();
+  server_port << local_port;
+  params.push_back(Param("GATEWAY_INTERFACE", "CGI/1.1"));
+  params.push_back(Param("SERVER_SOFTWARE", "webserv/1.0"));
+  params.push_back(
+      Param("SERVER_NAME", get_server_name(request, local_address)));
+  params.push_back(Param("SERVER_PORT", server_port.str()));
+  params.push_back(Param("SERVER_PROTOCOL", "HTTP/1.1"));
+  params.push_back(Param("REMOTE_ADDR", remote_address));
+  params.push_back(Param("REQUEST_METHOD", request.get_method()));
+  params.push_back(Param("REQUEST_URI", target));
+  params.push_back(Param("SCRIPT_NAME", target.substr(0, qpos)));
+  params.push_back(Param("SCRIPT_FILENAME", script_path));
+  params.push_back(Param("QUERY_STRING", qpos == std::string::npos
+                                             ? ""
+                                             : target.substr(qpos + 1)));
+  params.push_back(Param("CONTENT_LENGTH", content_length.str()));
+  params.push_back(
+      Param("CONTENT_TYPE", request.get_header_value("Content-Type")));
+
+  for (ConstHeaderMapIt it = request.headers_.begin();
+       it != request.headers_.end(); ++it) {
+    if (is_excluded_header(it->first))
+      continue;
+    std::string name = "HTTP_";
+    for (size_t i = 0; i < it->first.size(); ++i) {
+      char c = it->first[i];
+      name += (c == '-') ? '_' : static_cast<char>(std::toupper(c));
+    }
+    std::string value;
+    for (size_t i = 0; i < it->second.size(); ++i) {
+      value += (i == 0 ? "" : ", ") + it->second[i];
+    }
+    params.push_back(Param(name, value));
+  }
+  return params;
+}
+
+// execveに渡す "KEY=VALUE" 形式
+std::vector<std::string> build_cgi_env(const HttpRequest &request,
+                                       const std::string &script_path) {
+  std::vector<std::pair<std::string, std::string> > params =
+      build_cgi_params(request, script_path);
+  std::vector<std::string> env;
+
+  env.reserve(params.size());
+  for (size_t i = 0; i < params.size(); ++i) {
+    env.push_back(params[i].first + "=" + params[i].second);
+  }
+  return env;
+}
+
 } // namespace CgiUtils
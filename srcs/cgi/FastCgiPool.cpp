@@ -0,0 +1,130 @@
+#include "FastCgiPool.hpp"
+#include "Logger.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+FastCgiPool *FastCgiPool::instance_ = 0;
+
+const size_t FastCgiPool::k_max_idle_per_address = 32;
+
+static const char k_unix_prefix[] = "unix:";
+
+// 後から起動するCGIにbackendとの接続を引き継がせない
+// SOCK_CLOEXEC のないOSでは socket() の後に fcntl() で設定する
+static int open_unix_socket() {
+#if defined(__linux__)
+  return socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+#else
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1 ||
+      fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#endif
+}
+
+FastCgiPool &FastCgiPool::get_instance() {
+  if (!instance_) {
+    instance_ = new FastCgiPool();
+    std::atexit(FastCgiPool::delete_instance);
+  }
+  return *instance_;
+}
+
+void FastCgiPool::delete_instance() {
+  if (instance_) {
+    delete instance_;
+  }
+  instance_ = 0;
+}
+
+// idle接続があれば再利用し、なければ新しく接続する; 失敗時は-1
+int FastCgiPool::acquire(const std::string &address) {
+  IdleIt it = idle_.find(address);
+  if (it != idle_.end()) {
+    std::vector<int> &fds = it->second;
+    while (!fds.empty()) {
+      int fd = fds.back();
+      fds.pop_back();
+      if (is_alive(fd)) {
+        LOG_FD(LOG_DEBUG, "Reuse FastCGI connection fd: ", fd);
+        return fd;
+      }
+      close(fd);
+    }
+  }
+  return connect_to(address);
+}
+
+void FastCgiPool::release(const std::string &address, int fd) {
+  std::vector<int> &fds = idle_[address];
+  if (fds.size() >= k_max_idle_per_address) {
+    close(fd);
+    return;
+  }
+  LOG_FD(LOG_DEBUG, "Keep FastCGI connection idle fd: ", fd);
+  fds.push_back(fd);
+}
+
+int FastCgiPool::connect_to(const std::string &address) {
+  if (address.compare(0, sizeof(k_unix_prefix) - 1, k_unix_prefix) != 0) {
+    LOG(LOG_ERROR, "Unsupported fastcgi_pass address: " + address);
+    return -1;
+  }
+  std::string path = address.substr(sizeof(k_unix_prefix) - 1);
+  struct sockaddr_un addr;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    LOG(LOG_ERROR, "Invalid fastcgi_pass socket path: " + path);
+    return -1;
+  }
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+  int fd = open_unix_socket();
+  if (fd == -1) {
+    LOG(LOG_ERROR, "Failed to create FastCGI socket");
+    return -1;
+  }
+  // UNIX socket の connect は即時に完了するか、backlog満杯で失敗する
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) ==
+      -1) {
+    LOG(LOG_ERROR, "Failed to connect FastCGI server: " + address);
+    close(fd);
+    return -1;
+  }
+  LOG_FD(LOG_DEBUG, "New FastCGI connection fd: ", fd);
+  return fd;
+}
+
+// idle中にserver側から閉じられた接続を除外する
+bool FastCgiPool::is_alive(int fd) const {
+  char c;
+  return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == -1;
+}
+
+FastCgiPool::FastCgiPool() : idle_() {}
+
+FastCgiPool::~FastCgiPool() {
+  for (IdleIt it = idle_.begin(); it != idle_.end(); ++it) {
+    for (size_t i = 0; i < it->second.size(); ++i) {
+      close(it->second[i]);
+    }
+  }
+}
+
+FastCgiPool::FastCgiPool(const FastCgiPool &other) { (void)other; }
+
+FastCgiPool &FastCgiPool::operator=(const FastCgiPool &other) {
+  (void)other;
+  return *this;
+}
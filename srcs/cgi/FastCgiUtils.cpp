@@ -0,0 +1,169 @@
+#include "FastCgiUtils.hpp"
+#include "Logger.hpp"
+#include "ObjectPool.hpp"
+#include <algorithm>
+
+static const unsigned char k_fcgi_version = 1;
+static const size_t k_fcgi_header_len = 8;
+static const size_t k_fcgi_max_content = 65535;
+static const unsigned short k_fcgi_responder = 1;
+static const unsigned char k_fcgi_keep_conn = 1;
+static const int k_fcgi_request_complete = 0;
+
+namespace {
+
+void append_record(std::vector<char> &out, unsigned char type,
+                   unsigned short request_id, const char *content,
+                   size_t length) {
+  unsigned char padding = static_cast<unsigned char>((8 - length % 8) % 8);
+  char header[k_fcgi_header_len];
+
+  header[0] = k_fcgi_version;
+  header[1] = type;
+  header[2] = static_cast<char>((request_id >> 8) & 0xff);
+  header[3] = static_cast<char>(request_id & 0xff);
+  header[4] = static_cast<char>((length >> 8) & 0xff);
+  header[5] = static_cast<char>(length & 0xff);
+  header[6] = padding;
+  header[7] = 0;
+  out.insert(out.end(), header, header + k_fcgi_header_len);
+  out.insert(out.end(), content, content + length);
+  out.insert(out.end(), static_cast<size_t>(padding), '\0');
+}
+
+// 65535 byte を超える stream は複数のrecordに分割し、空のrecordで終端する
+void append_stream(std::vector<char> &out, unsigned char type,
+                   unsigned short request_id, const std::vector<char> &data) {
+  size_t off = 0;
+  while (off < data.size()) {
+    size_t len = std::min(data.size() - off, k_fcgi_max_content);
+    append_record(out, type, request_id, &data[off], len);
+    off += len;
+  }
+  append_record(out, type, request_id, NULL, 0);
+}
+
+void append_length(std::vector<char> &out, size_t length) {
+  if (length < 128) {
+    out.push_back(static_cast<char>(length));
+    return;
+  }
+  out.push_back(static_cast<char>(((length >> 24) & 0x7f) | 0x80));
+  out.push_back(static_cast<char>((length >> 16) & 0xff));
+  out.push_back(static_cast<char>((length >> 8) & 0xff));
+  out.push_back(static_cast<char>(length & 0xff));
+}
+
+size_t read_u16(const std::vector<char> &buf, size_t pos) {
+  return (static_cast<unsigned char>(buf[pos]) << 8) |
+         static_cast<unsigned char>(buf[pos + 1]);
+}
+
+} // namespace
+
+namespace FastCgiUtils {
+
+std::vector<char> encode_request(
+    unsigned short request_id,
+    const std::vector<std::pair<std::string, std::string> > &params,
+    const std::vector<char> &body, bool keep_conn) {
+  std::vector<char> out;
+  char begin_body[8] = {0};
+
+  begin_body[0] = static_cast<char>((k_fcgi_responder >> 8) & 0xff);
+  begin_body[1] = static_cast<char>(k_fcgi_responder & 0xff);
+  begin_body[2] = keep_conn ? k_fcgi_keep_conn : 0;
+  append_record(out, FCGI_BEGIN_REQUEST, request_id, begin_body,
+                sizeof(begin_body));
+
+  std::vector<char> param_data;
+  for (size_t i = 0; i < params.size(); ++i) {
+    append_length(param_data, params[i].first.size());
+    append_length(param_data, params[i].second.size());
+    param_data.insert(param_data.end(), params[i].first.begin(),
+                      params[i].first.end());
+    param_data.insert(param_data.end(), params[i].second.begin(),
+                      params[i].second.end());
+  }
+  append_stream(out, FCGI_PARAMS, request_id, param_data);
+  append_stream(out, FCGI_STDIN, request_id, body);
+  return out;
+}
+
+} // namespace FastCgiUtils
+
+FastCgiRecordParser::FastCgiRecordParser()
+    : buf_(), ended_(false), has_error_(false), app_status_(0),
+      protocol_status_(k_fcgi_request_complete) {}
+
+FastCgiRecordParser::~FastCgiRecordParser() {}
+
+void FastCgiRecordParser::clear() {
+  release_buffer(buf_);
+  ended_ = false;
+  has_error_ = false;
+  app_status_ = 0;
+  protocol_status_ = k_fcgi_request_complete;
+}
+
+void FastCgiRecordParser::append(const char *data, size_t length) {
+  buf_.insert(buf_.end(), data, data + length);
+}
+
+// 揃っているrecordを全て処理し、STDOUTの中身をstdout_dataに追記する
+void FastCgiRecordParser::parse(std::vector<char> &stdout_data) {
+  size_t pos = 0;
+
+  while (!ended_ && buf_.size() - pos >= k_fcgi_header_len) {
+    unsigned char version = static_cast<unsigned char>(buf_[pos]);
+    unsigned char type = static_cast<unsigned char>(buf_[pos + 1]);
+    size_t content_len = read_u16(buf_, pos + 4);
+    size_t padding_len = static_cast<unsigned char>(buf_[pos + 6]);
+    size_t record_len = k_fcgi_header_len + content_len + padding_len;
+
+    if (version != k_fcgi_version) {
+      LOG(LOG_ERROR, "Unsupported FastCGI record version");
+      has_error_ = true;
+      ended_ = true;
+      break;
+    }
+    if (buf_.size() - pos < record_len) {
+      break; // record未受信
+    }
+    size_t content = pos + k_fcgi_header_len;
+    if (type == FastCgiUtils::FCGI_STDOUT) {
+      stdout_data.insert(stdout_data.end(), buf_.begin() + content,
+                         buf_.begin() + content + content_len);
+    } else if (type == FastCgiUtils::FCGI_STDERR && content_len > 0) {
+      LOG(LOG_WARNING,
+          "FastCGI stderr: " + std::string(buf_.begin() + content,
+                                           buf_.begin() + content +
+                                               content_len));
+    } else if (type == FastCgiUtils::FCGI_END_REQUEST && content_len >= 8) {
+      app_status_ = (static_cast<unsigned char>(buf_[content]) << 24) |
+                    (static_cast<unsigned char>(buf_[content + 1]) << 16) |
+                    (static_cast<unsigned char>(buf_[content + 2]) << 8) |
+                    static_cast<unsigned char>(buf_[content + 3]);
+      protocol_status_ = static_cast<unsigned char>(buf_[content + 4]);
+      ended_ = true;
+    }
+    pos += record_len;
+  }
+  buf_.erase(buf_.begin(), buf_.begin() + pos);
+}
+
+bool FastCgiRecordParser::is_ended() const { return ended_; }
+
+// END_REQUEST を正常に受け取り、余分なデータが残っていなければ接続を再利用できる
+bool FastCgiRecordParser::is_reusable() const {
+  return (ended_ && !has_error_ && buf_.empty() &&
+          protocol_status_ == k_fcgi_request_complete);
+}
+
+int FastCgiRecordParser::get_app_status() const { return app_status_; }
+
+FastCgiRecordParser &
+FastCgiRecordParser::operator=(const FastCgiRecordParser &other) {
+  (void)other;
+  return *this;
+}
@@ -2,29 +2,92 @@
 #include "Client.hpp"
 #include "CgiSession.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "ObjectPool.hpp"
+#include <algorithm>
+#include <climits>
 #include <cstddef>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sstream>
 #include <stdexcept>
+#include <sys/uio.h>
 
 static const int k_default_timeout = 15;
 
-Client::Client(int clientfd, const VirtualHostRouter *router)
+// 1回のwritevで渡すsegment数の上限
+static const int k_max_iov = IOV_MAX;
+
+Client::Client(int clientfd, const VirtualHostRouter *router,
+               const ListenOptions &options)
     : fd_(clientfd), state_(CLIENT_ALIVE), timeout_sec_(k_default_timeout),
-      last_activity_(time(NULL)), transaction_(clientfd, router) {}
+      last_activity_(time(NULL)), tcp_nodelay_(options.nodelay),
+      tcp_cork_(options.cork), nodelay_set_(false), corked_(false),
+      awaiting_writable_(false), transaction_(clientfd, router) {}
+
+Client::Client()
+    : fd_(-1), state_(CLIENT_ALIVE), timeout_sec_(k_default_timeout),
+      last_activity_(0), tcp_nodelay_(false), tcp_cork_(false),
+      nodelay_set_(false), corked_(false), awaiting_writable_(false),
+      transaction_(-1, NULL) {}
 
 Client::~Client() {
-  if (fd_ != -1) {
-    if (close(fd_) < 0) {
-      logfd(LOG_ERROR, "Failed to close client fd: ", fd_);
-    }
-    fd_ = -1;
-  }
+  close_fd();
   transaction_.handle_client_abort();
 }
 
+// poolに待機中のClientがあれば再利用し、なければnewする
+Client *Client::create(int clientfd, const VirtualHostRouter *router,
+                       const ListenOptions &options) {
+  Client *client = ObjectPool<Client>::get_instance().acquire();
+  if (!client) {
+    return new Client(clientfd, router, options);
+  }
+  client->fd_ = clientfd;
+  client->tcp_nodelay_ = options.nodelay;
+  client->tcp_cork_ = options.cork;
+  client->update_activity();
+  client->transaction_.attach(clientfd, router);
+  return client;
+}
+
+// deleteの代わり; 上限を超えていなければrecycle()してpoolに戻す
+void Client::release(Client *client) {
+  ObjectPool<Client>::get_instance().release(client);
+}
+
+// destructorと同じくfdを閉じ、HTTP処理の状態を初期化する
+void Client::recycle() {
+  close_fd();
+  transaction_.recycle();
+  state_ = CLIENT_ALIVE;
+  timeout_sec_ = k_default_timeout;
+  nodelay_set_ = false;
+  corked_ = false;
+  awaiting_writable_ = false;
+}
+
+bool Client::is_idle() const { return fd_ == -1; }
+
 int Client::get_fd() const { return fd_; }
 
+bool Client::is_awaiting_writable() const { return awaiting_writable_; }
+
+const std::string &Client::get_request_line() const {
+  return transaction_.get_request_line();
+}
+
 IOStatus Client::on_read() {
+  LOG_DEBUG_FUNC();
+  IOStatus status = receive();
+  if (status != IO_CONTINUE) {
+    return status;
+  }
+  return process_received();
+}
+
+// socketから読んでparserに渡すだけ; parseと応答の生成は process_received()
+IOStatus Client::receive() {
   LOG_DEBUG_FUNC();
   const int buf_size = 1024;
   char buffer[buf_size];
@@ -34,8 +97,13 @@ IOStatus Client::on_read() {
     return IO_SHOULD_CLOSE;
   }
   update_activity();
+  Metrics::get_instance().count_bytes_in(bytes_read);
   transaction_.append_data(buffer, bytes_read);
+  return IO_CONTINUE;
+}
 
+IOStatus Client::process_received() {
+  LOG_DEBUG_FUNC();
   switch (state_) {
   case CLIENT_TIMED_OUT:
     return IO_CONTINUE;
@@ -58,31 +126,57 @@ IOStatus Client::on_write() {
     return IO_WRITE_COMPLETE;
   }
 
-  ResponseEntry *entry = transaction_.get_response();
-  const std::vector<char> &buf = entry->buffer;
-  size_t &offset = entry->offset;
+  // queueに積まれた応答をまとめて1回のwritevで送る
+  // (IOV_MAX個のiovecはstackに置くには大きいのでstatic)
+  static struct iovec iov[k_max_iov];
+  size_t bytes_left = 0;
+  int iovcnt = transaction_.fill_iovec(iov, k_max_iov);
+  if (iovcnt > 0) {
+    if (transaction_.get_response()->conn == CP_KEEP_ALIVE) {
+      enable_nodelay();
+    }
+    ssize_t bytes_sent = writev(fd_, iov, iovcnt);
+    if (bytes_sent <= 0) {
+      transaction_.handle_client_abort();
+      return IO_SHOULD_CLOSE;
+    }
+    update_activity();
+    Metrics::get_instance().count_bytes_out(bytes_sent);
+    bytes_left = bytes_sent;
+  }
 
-  ssize_t bytes_sent = send(fd_, buf.data() + offset, buf.size() - offset, 0);
-  if (bytes_sent <= 0) {
-    transaction_.handle_client_abort();
-    return IO_SHOULD_CLOSE;
+  // 送り終えたentryから順に、接続の後処理を行う
+  // 空のentryは送信せず、接続の終了処理だけを行う
+  IOStatus io_status = IO_CONTINUE;
+  while (io_status == IO_CONTINUE && transaction_.has_response()) {
+    ResponseEntry *entry = transaction_.get_response();
+    size_t sent = std::min(bytes_left, entry->length - entry->offset);
+    entry->offset += sent;
+    bytes_left -= sent;
+    if (entry->offset < entry->length) {
+      set_cork(true); // 残りは次のwritevで; 途中の半端なsegmentを出さない
+      awaiting_writable_ = true;
+      return IO_CONTINUE; // partial write
+    }
+    ConnectionPolicy conn = entry->conn;
+    transaction_.pop_response();
+    io_status = transaction_.decide_io_after_write(conn);
   }
-  update_activity();
-  offset += bytes_sent;
-  if (offset < buf.size()) {
-    return IO_CONTINUE; // partial write
+  awaiting_writable_ = false;
+  if (!transaction_.has_response()) {
+    transaction_.on_response_flushed();
   }
-
-  ConnectionPolicy conn = entry->conn;
-  transaction_.pop_response();
-
-  IOStatus io_status = transaction_.decide_io_after_write(conn);
+  // 送るものが残っている間だけcorkし、queueが空になったら外して送り出す
+  set_cork(io_status == IO_CONTINUE && transaction_.has_response());
   if (io_status == IO_SHOULD_SHUTDOWN) {
     state_ = CLIENT_HALF_CLOSED;
   }
   return io_status;
 }
 
+// CGIの出力がspliceでsocketへ直接送られた; 送信の進捗として扱う
+void Client::on_cgi_relay() { update_activity(); }
+
 IOStatus Client::on_timeout() {
   if (state_ != CLIENT_ALIVE) {
     return IO_CONTINUE;
@@ -104,6 +198,45 @@ bool Client::is_unresponsive(time_t now) const {
 
 void Client::update_activity() { last_activity_ = time(NULL); }
 
+// Nagleで、先に送ったheaderのACK待ちにbodyが止められないようにする
+// keep-aliveの応答を初めて送る前に1回だけ設定する
+void Client::enable_nodelay() {
+  if (!tcp_nodelay_ || nodelay_set_) {
+    return;
+  }
+  int on = 1;
+  if (setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1) {
+    LOG_FD(LOG_WARNING, "Failed to set TCP_NODELAY on socket: ", fd_);
+  }
+  nodelay_set_ = true;
+}
+
+// 1回のwritevで書き切れない応答は、残りをcorkしてMSS単位で送る
+// corkを外すと、保留していた分がすぐに送られる
+void Client::set_cork(bool on) {
+#if defined(TCP_CORK)
+  if (!tcp_cork_ || corked_ == on) {
+    return;
+  }
+  int value = on ? 1 : 0;
+  if (setsockopt(fd_, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == -1) {
+    LOG_FD(LOG_WARNING, "Failed to set TCP_CORK on socket: ", fd_);
+  }
+  corked_ = on;
+#else
+  (void)on;
+#endif
+}
+
+void Client::close_fd() {
+  if (fd_ != -1) {
+    if (close(fd_) < 0) {
+      LOG_FD(LOG_ERROR, "Failed to close client fd: ", fd_);
+    }
+    fd_ = -1;
+  }
+}
+
 Client &Client::operator=(const Client &other) {
   (void)other;
   return *this;
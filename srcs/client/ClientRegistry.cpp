@@ -13,7 +13,7 @@ ClientRegistry::~ClientRegistry() {
 
 void ClientRegistry::add(int fd, Client *client) {
   if (has(fd)) {
-    logfd(LOG_ERROR, "Duplicate client fd: ", fd);
+    LOG_FD(LOG_ERROR, "Duplicate client fd: ", fd);
     return;
   }
   fd_to_clients_[fd] = client;
@@ -22,10 +22,10 @@ void ClientRegistry::add(int fd, Client *client) {
 void ClientRegistry::remove(int fd) {
   ClientIt it = fd_to_clients_.find(fd);
   if (it == fd_to_clients_.end()) {
-    logfd(LOG_ERROR, "Client not in registry fd: ", fd);
+    LOG_FD(LOG_ERROR, "Client not in registry fd: ", fd);
     return;
   }
-  delete it->second;
+  Client::release(it->second);
   fd_to_clients_.erase(fd);
 }
 
@@ -41,6 +41,10 @@ bool ClientRegistry::has(int fd) const {
   return fd_to_clients_.find(fd) != fd_to_clients_.end();
 }
 
+size_t ClientRegistry::get_client_count() const {
+  return fd_to_clients_.size();
+}
+
 std::vector<int> ClientRegistry::mark_timed_out_clients() {
   time_t now = time(NULL);
   std::vector<int> timed_out_clients;
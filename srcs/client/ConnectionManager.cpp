@@ -1,26 +1,39 @@
 #include "ConnectionManager.hpp"
 #include "Client.hpp"
 #include "Logger.hpp"
+#include <cerrno>
 #include <fcntl.h>
 
-int ConnectionManager::accept_new_connection(int server_fd) {
-  LOG_DEBUG_FUNC_FD(server_fd);
-  struct sockaddr_storage client_addr;
-  socklen_t addrlen = sizeof(client_addr);
-  int new_fd = accept(server_fd, (struct sockaddr *)&client_addr, &addrlen);
+// accept4() でnon-blockingとclose-on-execを同時に設定する (syscallを1回に)
+// accept4() のないOSでは accept() の後に fcntl() で設定する
+static int accept_nonblocking(int server_fd) {
+#if defined(__linux__)
+  return accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  int new_fd = accept(server_fd, NULL, NULL);
   if (new_fd == -1) {
-    logfd(LOG_ERROR, "Failed to accept new connection on socket: ", server_fd);
     return -1;
   }
-  if (fcntl(new_fd, F_SETFL, fcntl(new_fd, F_GETFL) | O_NONBLOCK) == -1) {
-    logfd(LOG_ERROR, "Failed to set O_NONBLOCK on socket: ", new_fd);
+  if (fcntl(new_fd, F_SETFL, fcntl(new_fd, F_GETFL) | O_NONBLOCK) == -1 ||
+      fcntl(new_fd, F_SETFD, FD_CLOEXEC) == -1) {
+    LOG_FD(LOG_ERROR, "Failed to set O_NONBLOCK on socket: ", new_fd);
     close(new_fd);
     return -1;
   }
-  int opt = 1;
-  if (setsockopt(new_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
-    logfd(LOG_ERROR, "Failed to set SO_REUSEADDR on socket: ", new_fd);
-    close(new_fd);
+  return new_fd;
+#endif
+}
+
+// backlogが空なら -1 (呼び出し側はそこで受け付けを打ち切る)
+int ConnectionManager::accept_new_connection(int server_fd) {
+  LOG_DEBUG_FUNC_FD(server_fd);
+  errno = 0;
+  int new_fd = accept_nonblocking(server_fd);
+  if (new_fd == -1) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      LOG_FD(LOG_ERROR, "Failed to accept new connection on socket: ",
+            server_fd);
+    }
     return -1;
   }
   return new_fd;
@@ -11,10 +11,13 @@
 /* ************************************************************************** */
 
 #include "ConfigParse.hpp"
+#include "AccessLog.hpp"
+#include "SocketBuilder.hpp"
 
-Parse::Parse(){}
+Parse::Parse() : stall_threshold_ms(-1), in_events_block(false) {}
 
 Parse::Parse(std::string config_path)
+    : stall_threshold_ms(-1), in_events_block(false)
 {
     _config_path = config_path;
 }
@@ -24,6 +27,9 @@ Parse::~Parse(){}
 Parse::Parse(const Parse &src)
 {
     this->_config_path = src._config_path;
+    this->event_backend = src.event_backend;
+    this->stall_threshold_ms = src.stall_threshold_ms;
+    this->in_events_block = src.in_events_block;
 }
 
 Parse& Parse::operator=(const Parse &src)
@@ -31,13 +37,16 @@ Parse& Parse::operator=(const Parse &src)
     if (this != &src)
     {
         _config_path = src._config_path;
+        event_backend = src.event_backend;
+        stall_threshold_ms = src.stall_threshold_ms;
+        in_events_block = src.in_events_block;
     }
     return (*this);
 }
 
 /* Validateに関するコード*/
 const char* Parse::valid_keys[] = {
-    "listen", "root", "index", "error_page", "autoindex", "server_name", "allow_methods", "client_max_body_size", "return", "cgi_extensions", "upload_path", "alias", "cgi-bin"
+    "listen", "root", "index", "error_page", "autoindex", "server_name", "allow_methods", "client_max_body_size", "return", "cgi_extensions", "upload_path", "alias", "cgi-bin", "fastcgi_pass", "client_pool_size", "cgi_session_pool_size", "slow_request_ms", "access_log", "log_format"
 };
 
 
@@ -50,7 +59,11 @@ void Parse::validate_config(const std::map<std::string, std::vector<std::string>
     validate_config_keys(config);
     validate_listen_ip(config);
     validate_listen_port(config);
+    validate_listen_options(config);
+    validate_number_values(config);
+    AccessLog::validate(config);
     validate_duplicate_server_name_within_listen(config);
+    validate_duplicate_listen_options(config);
     validate_location_path(config);
 }
 
@@ -103,7 +116,7 @@ void Parse::validate_duplicate_server_name_within_listen(const std::map<std::str
     std::vector<ListenPair> listens;
     for (size_t i = 0; i < listen_it->second.size(); ++i) {
         std::string token = listen_it->second[i];
-        if (token == "default_server") {
+        if (SocketBuilder::is_listen_option(token)) {
             continue;
         }
         std::string ip = "0.0.0.0";
@@ -133,6 +146,39 @@ void Parse::validate_duplicate_server_name_within_listen(const std::map<std::str
     }
 }
 
+// 同じip:portを複数のserverで共有するとき、socketのparameterを書けるのは1つだけ
+// (listen socketは1つなので、食い違う指定を黙って捨てないようにする)
+void Parse::validate_duplicate_listen_options(const std::map<std::string, std::vector<std::string> >& config)
+{
+    std::map<std::string, std::vector<std::string> >::const_iterator listen_it = config.find("listen");
+    if (listen_it == config.end())
+        return;
+
+    bool has_options = false;
+    for (size_t i = 0; i < listen_it->second.size(); ++i) {
+        const std::string &token = listen_it->second[i];
+        if (SocketBuilder::is_listen_option(token) && token != "default_server")
+            has_options = true;
+    }
+    if (!has_options)
+        return;
+
+    for (size_t i = 0; i < listen_it->second.size(); ++i) {
+        std::string token = listen_it->second[i];
+        if (SocketBuilder::is_listen_option(token))
+            continue;
+        std::string ip = "0.0.0.0";
+        std::string port = token;
+        size_t colon = port.find(':');
+        if (colon != std::string::npos) {
+            ip = port.substr(0, colon);
+            port = port.substr(colon + 1);
+        }
+        if (!listens_with_options.insert(std::make_pair(ip, port)).second)
+            throw std::runtime_error("Duplicate listen options for " + ip + ":" + port);
+    }
+}
+
 bool Parse::server_name_conflict(const std::string &a, const std::string &b) {
     return (a == b || wildcard_match(a, b) || wildcard_match(b, a));
 }
@@ -186,6 +232,8 @@ void Parse::validate_listen_ip(const std::map<std::string, std::vector<std::stri
     std::map<std::string, std::vector<std::string> >::const_iterator it = config.find("listen");
     if (it != config.end()) {
         for (size_t j = 0; j < it->second.size(); j++) {
+            if (SocketBuilder::is_listen_option(it->second[j]))
+                continue;
             std::string listen_value = space_outer_trim(it->second[j]);
             size_t colon_pos = listen_value.find(':');
             size_t dot_pos = listen_value.find('.');
@@ -209,6 +257,8 @@ void Parse::validate_listen_port(const std::map<std::string, std::vector<std::st
     std::map<std::string, std::vector<std::string> >::const_iterator it = config.find("listen");
     if (it != config.end()) {
         for (size_t j = 0; j < it->second.size(); j++) {
+            if (SocketBuilder::is_listen_option(it->second[j]))
+                continue;
             std::string port_str;
             size_t colon_pos = it->second[j].find(':');
 
@@ -218,10 +268,6 @@ void Parse::validate_listen_port(const std::map<std::string, std::vector<std::st
                 port_str = it->second[j];
             }
 
-            if (port_str == "default_server") {
-                continue;
-            }
-
             std::stringstream ss(port_str);
             int port;
             if (!(ss >> port) || port < 1 || port > 65535) {
@@ -231,10 +277,42 @@ void Parse::validate_listen_port(const std::map<std::string, std::vector<std::st
     }
 }
 
+void Parse::validate_listen_options(const std::map<std::string, std::vector<std::string> >& config)
+{
+    std::map<std::string, std::vector<std::string> >::const_iterator it = config.find("listen");
+    if (it != config.end()) {
+        ListenOptions options;
+        for (size_t j = 0; j < it->second.size(); j++) {
+            if (!SocketBuilder::is_listen_option(it->second[j]))
+                continue;
+            if (!SocketBuilder::parse_listen_option(it->second[j], options))
+                throw std::runtime_error("Unknown parameter in listen directive: " + it->second[j]);
+        }
+    }
+}
+
+// 0以上の整数を1つだけ取るkey; server, locationのどちらでも起動時に確かめる
+void Parse::validate_number_values(const std::map<std::string, std::vector<std::string> >& config)
+{
+    static const char* number_keys[] = {"slow_request_ms"};
+    for (size_t i = 0; i < sizeof(number_keys) / sizeof(*number_keys); i++) {
+        std::map<std::string, std::vector<std::string> >::const_iterator it = config.find(number_keys[i]);
+        if (it == config.end())
+            continue;
+        if (it->second.size() != 1 || it->second[0].empty() || !is_all_digits(it->second[0]))
+            throw std::runtime_error(std::string("Invalid value for ") + number_keys[i] + ": must be a non-negative integer");
+        str_to_int(it->second[0]); // intに収まらなければthrow
+    }
+}
+
 bool Parse::is_server_start(const std::string& line) {
     return line == "server {";
 }
 
+bool Parse::is_events_start(const std::string& line) {
+    return line == "events {";
+}
+
 bool Parse::is_server_end(const std::string& line, bool in_server_block, bool in_location_block) {
     return line == "}" && in_server_block && !in_location_block;
 }
@@ -280,11 +358,17 @@ std::vector<std::pair<std::map<std::string, std::vector<std::string> >,
             found_server_block = true;
         if (!in_server_block && !current_server_config.empty()) {
             validate_config(current_server_config);
+            for (std::map<std::string, std::map<std::string, std::vector<std::string> > >::const_iterator loc = current_location_configs.begin();
+                 loc != current_location_configs.end(); ++loc)
+                validate_number_values(loc->second);
             server_location_configs.push_back(std::make_pair(current_server_config, current_location_configs));
             reset_server_config(current_server_config, current_location_configs, server_root_seen);
         }
     }
 
+    if (in_events_block) {
+        throw std::runtime_error("Unclosed events block.");
+    }
     if (!found_server_block) {
         throw std::runtime_error("No server block found in config file.");
     }
@@ -302,6 +386,16 @@ void Parse::process_line(std::string& line, std::map<std::string, std::vector<st
         return;
     }
 
+    if (is_events_start(line)) {
+        if (in_server_block || in_events_block)
+            throw std::runtime_error("events block must be at the top level.");
+        in_events_block = true;
+        return;
+    } else if (in_events_block) {
+        handle_events_block(line);
+        return;
+    }
+
     if (is_server_start(line)) {
         if (in_server_block)
             throw std::runtime_error("Nested server blocks are not allowed.");
@@ -318,6 +412,49 @@ void Parse::process_line(std::string& line, std::map<std::string, std::vector<st
         throw std::runtime_error("Invalid config structure: No active server block.");
 }
 
+// events block: use (I/O多重化の実装の選択) と
+// stall_threshold_ms (event処理1件がこれ以上かかったらlogに出す; 0で無効)
+void Parse::handle_events_block(const std::string& line)
+{
+    if (line == "}") {
+        in_events_block = false;
+        return;
+    }
+
+    std::string key;
+    std::vector<std::string> values;
+    parse_key_value(line, key, values);
+
+    if (key == "stall_threshold_ms") {
+        if (stall_threshold_ms != -1)
+            throw std::runtime_error("Duplicate stall_threshold_ms directive in events block.");
+        if (values.size() != 1)
+            throw std::runtime_error("Invalid stall_threshold_ms directive: " + line);
+        int ms = str_to_int(values[0]);
+        if (ms < 0)
+            throw std::runtime_error("Invalid stall_threshold_ms: " + values[0]);
+        stall_threshold_ms = ms;
+        return;
+    }
+    if (key != "use")
+        throw std::runtime_error("Invalid key in events block: " + key);
+    if (!event_backend.empty())
+        throw std::runtime_error("Duplicate use directive in events block.");
+    if (values.size() != 1)
+        throw std::runtime_error("Invalid use directive: " + line);
+    event_backend = values[0];
+}
+
+const std::string& Parse::get_event_backend() const
+{
+    return event_backend;
+}
+
+int Parse::get_stall_threshold_ms() const
+{
+    return stall_threshold_ms;
+}
+
 void Parse::handle_server_block(const std::string& line, std::map<std::string, std::vector<std::string> >& current_config, std::map<std::string, std::map<std::string, std::vector<std::string> > >& location_configs, bool& in_location_block, std::string& current_location_path, bool& server_root_seen)
 {
     if (is_location_start(line)) {
@@ -0,0 +1,110 @@
+#include "ChildReaper.hpp"
+#include "Logger.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/signalfd.h>
+#endif
+
+#if !defined(__linux__)
+static int g_notify_fd = -1;
+
+// async-signal-safe な処理だけを行う
+static void notify_sigchld(int sig) {
+  const int saved_errno = errno;
+  const char c = 0;
+  (void)sig;
+  ssize_t ret = write(g_notify_fd, &c, 1); // pipeが満杯なら通知済みなので捨てる
+  (void)ret;
+  errno = saved_errno;
+}
+
+static bool set_nonblock_cloexec(int fd) {
+  return (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != -1 &&
+          fcntl(fd, F_SETFD, FD_CLOEXEC) != -1);
+}
+#endif
+
+ChildReaper::ChildReaper() : fd_(-1), write_fd_(-1) {}
+
+ChildReaper::~ChildReaper() {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+  if (write_fd_ != -1) {
+    close(write_fd_);
+  }
+}
+
+// 子processを起動する前に呼ぶ
+void ChildReaper::open() {
+#if defined(__linux__)
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+    throw std::runtime_error("sigprocmask failed: " +
+                             std::string(strerror(errno)));
+  }
+  fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd_ == -1) {
+    throw std::runtime_error("signalfd failed: " +
+                             std::string(strerror(errno)));
+  }
+#else
+  int fds[2];
+  if (pipe(fds) == -1) {
+    throw std::runtime_error("pipe failed: " + std::string(strerror(errno)));
+  }
+  fd_ = fds[0];
+  write_fd_ = fds[1];
+  if (!set_nonblock_cloexec(fd_) || !set_nonblock_cloexec(write_fd_)) {
+    throw std::runtime_error("fcntl failed: " + std::string(strerror(errno)));
+  }
+  g_notify_fd = write_fd_;
+
+  struct sigaction sa;
+  std::memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = notify_sigchld;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  if (sigaction(SIGCHLD, &sa, NULL) == -1) {
+    throw std::runtime_error("sigaction failed: " +
+                             std::string(strerror(errno)));
+  }
+#endif
+}
+
+int ChildReaper::get_fd() const { return fd_; }
+
+// 通知を読み捨てる; 複数のSIGCHLDは1つにまとまり得るので、回収はreap()で行う
+void ChildReaper::drain() {
+#if defined(__linux__)
+  struct signalfd_siginfo info;
+  while (read(fd_, &info, sizeof(info)) == sizeof(info)) {
+  }
+#else
+  char buf[64];
+  while (read(fd_, buf, sizeof(buf)) > 0) {
+  }
+#endif
+}
+
+// 終了済みの子processを1つ回収する; なければfalse
+bool ChildReaper::reap(pid_t &pid, int &status) {
+  pid = waitpid(-1, &status, WNOHANG);
+  return pid > 0;
+}
+
+ChildReaper::ChildReaper(const ChildReaper &other) { (void)other; }
+
+ChildReaper &ChildReaper::operator=(const ChildReaper &other) {
+  (void)other;
+  return *this;
+}
@@ -12,12 +12,13 @@
 
 #include "EpollMultiplexer.hpp"
 #include "Logger.hpp"
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 
 Multiplexer &EpollMultiplexer::get_instance() {
   if (!Multiplexer::instance_) {
-    log(LOG_INFO, "EpollMultiplexer::get_instance()");
+    LOG(LOG_INFO, "EpollMultiplexer::get_instance()");
     Multiplexer::instance_ = new EpollMultiplexer();
     std::atexit(Multiplexer::delete_instance);
   }
@@ -26,16 +27,16 @@ Multiplexer &EpollMultiplexer::get_instance() {
 
 void EpollMultiplexer::run() {
   LOG_DEBUG_FUNC();
-  static const int max_epoll_events = 3599293;
-  int size = 16; // num of fd; expect to monitor; not upper limit
+  static const size_t max_epoll_events = 3599293;
+  static const size_t min_epoll_events = 16;
+  // 1/4も埋まらない周回がこれだけ続いたら半分に縮める
+  static const int shrink_after = 8;
 
-  std::vector<struct epoll_event> evlist;
+  std::vector<struct epoll_event> evlist(min_epoll_events);
+  std::vector<ReadyEvent> ready;
+  int sparse_iterations = 0;
 
   while (true) {
-    if (size > max_epoll_events) {
-      throw std::runtime_error("epoll event list exceeds limit");
-    }
-    evlist.resize(size);
     handle_timeouts();
     errno = 0;
     int nfd = epoll_wait(epfd_, evlist.data(), evlist.size(), k_timeout_ms_);
@@ -46,12 +47,28 @@ void EpollMultiplexer::run() {
       throw std::runtime_error("epoll_wait() failed");
     }
 
+    ready.resize(nfd);
     for (int i = 0; i < nfd; ++i) {
-      process_event(evlist[i].data.fd, is_readable(evlist[i]),
-                    is_writable(evlist[i]));
+      ready[i].fd = evlist[i].data.fd;
+      ready[i].readable = is_readable(evlist[i]);
+      ready[i].writable = is_writable(evlist[i]);
     }
-    if (nfd == size) {
-      size *= 2;
+    process_events(ready);
+
+    // 大きさを変えるのは、溢れたときと、空きの多い周回が続いたときだけ
+    size_t size = evlist.size();
+    if (static_cast<size_t>(nfd) == size && size < max_epoll_events) {
+      evlist.resize(std::min(size * 2, max_epoll_events));
+      sparse_iterations = 0;
+    } else if (size > min_epoll_events &&
+               static_cast<size_t>(nfd) < size / 4) {
+      if (++sparse_iterations >= shrink_after) {
+        evlist.resize(size / 2);
+        std::vector<struct epoll_event>(evlist).swap(evlist);
+        sparse_iterations = 0;
+      }
+    } else {
+      sparse_iterations = 0;
     }
   }
 }
@@ -65,12 +82,12 @@ void EpollMultiplexer::monitor_read(int fd) {
 
   if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
     if (errno != EEXIST) {
-      logfd(LOG_ERROR, "epoll_ctl ADD failed (EPOLLIN): ", fd);
+      LOG_FD(LOG_ERROR, "epoll_ctl ADD failed (EPOLLIN): ", fd);
       return;
     }
-    logfd(LOG_WARNING, "fd already under monitor: ", fd);
+    LOG_FD(LOG_WARNING, "fd already under monitor: ", fd);
     if (epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == -1) {
-      logfd(LOG_ERROR, "epoll_ctl MOD fallback failed (EPOLLIN): ", fd);
+      LOG_FD(LOG_ERROR, "epoll_ctl MOD fallback failed (EPOLLIN): ", fd);
     }
   }
 }
@@ -85,12 +102,12 @@ void EpollMultiplexer::monitor_write(int fd) {
   if (epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == -1) {
 
     if (errno != ENOENT) {
-      logfd(LOG_ERROR, "epoll_ctl MOD failed (EPOLLOUT): ", fd);
+      LOG_FD(LOG_ERROR, "epoll_ctl MOD failed (EPOLLOUT): ", fd);
       return;
     }
-    logfd(LOG_WARNING, "fd not in read monitor. Adding it now: ", fd);
+    LOG_FD(LOG_WARNING, "fd not in read monitor. Adding it now: ", fd);
     if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
-      logfd(LOG_ERROR, "epoll_ctl ADD fallback failed (EPOLLOUT): ", fd);
+      LOG_FD(LOG_ERROR, "epoll_ctl ADD fallback failed (EPOLLOUT): ", fd);
     }
   }
 }
@@ -104,12 +121,12 @@ void EpollMultiplexer::unmonitor_write(int fd) {
 
   if (epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == -1) {
     if (errno != ENOENT) {
-      logfd(LOG_ERROR, "epoll_ctl MOD failed (EPOLLIN): ", fd);
+      LOG_FD(LOG_ERROR, "epoll_ctl MOD failed (EPOLLIN): ", fd);
       return;
     }
-    logfd(LOG_WARNING, "fd not in read monitor. Adding it now: ", fd);
+    LOG_FD(LOG_WARNING, "fd not in read monitor. Adding it now: ", fd);
     if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
-      logfd(LOG_ERROR, "epoll_ctl ADD fallback failed (EPOLLIN): ", fd);
+      LOG_FD(LOG_ERROR, "epoll_ctl ADD fallback failed (EPOLLIN): ", fd);
       return;
     }
   }
@@ -124,15 +141,17 @@ void EpollMultiplexer::unmonitor(int fd) {
 
   if (epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, &ev) == -1) {
     if (errno != ENOENT) {
-      logfd(LOG_ERROR, "failed to delete fd: ", fd);
+      LOG_FD(LOG_ERROR, "failed to delete fd: ", fd);
       return;
     }
-    logfd(LOG_WARNING, "fd already erased: ", fd);
+    LOG_FD(LOG_WARNING, "fd already erased: ", fd);
   }
 }
 
 void EpollMultiplexer::monitor_pipe_read(int fd) { monitor_read(fd); }
 
+void EpollMultiplexer::unmonitor_pipe_read(int fd) { unmonitor(fd); }
+
 void EpollMultiplexer::monitor_pipe_write(int fd) {
   LOG_DEBUG_FUNC_FD(fd);
 
@@ -142,18 +161,19 @@ void EpollMultiplexer::monitor_pipe_write(int fd) {
 
   if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
     if (errno != EEXIST) {
-      logfd(LOG_ERROR, "epoll_ctl ADD failed (EPOLLIN): ", fd);
+      LOG_FD(LOG_ERROR, "epoll_ctl ADD failed (EPOLLIN): ", fd);
       return;
     }
-    logfd(LOG_WARNING, "fd already under monitor: ", fd);
+    LOG_FD(LOG_WARNING, "fd already under monitor: ", fd);
     if (epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == -1) {
-      logfd(LOG_ERROR, "epoll_ctl MOD fallback failed (EPOLLIN): ", fd);
+      LOG_FD(LOG_ERROR, "epoll_ctl MOD fallback failed (EPOLLIN): ", fd);
     }
   }
 }
 
+// 書き込み側が閉じたpipeは EPOLLHUP のみ通知されるので、readとして扱いEOFを拾う
 bool EpollMultiplexer::is_readable(struct epoll_event &ev) const {
-  return ev.events & EPOLLIN;
+  return ev.events & (EPOLLIN | EPOLLHUP | EPOLLERR);
 }
 
 bool EpollMultiplexer::is_writable(struct epoll_event &ev) const {
@@ -0,0 +1,368 @@
+#include "IoUringMultiplexer.hpp"
+#include "EpollMultiplexer.hpp"
+#include "Logger.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// liburing を使わず、system callを直接呼ぶ
+static int io_uring_setup(unsigned entries, struct io_uring_params *params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit,
+                          unsigned min_complete, unsigned flags, void *arg,
+                          size_t argsz) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                  min_complete, flags, arg, argsz));
+}
+
+// user_data: 上位32bitに登録ごとの世代, 下位32bitにfd
+// 世代が変わっていれば、取り消し済みの古いpollの完了として捨てる
+static unsigned long long make_user_data(unsigned generation, int fd) {
+  return (static_cast<unsigned long long>(generation) << 32) |
+         static_cast<unsigned>(fd);
+}
+
+static int user_data_fd(unsigned long long user_data) {
+  return static_cast<int>(user_data & 0xffffffffULL);
+}
+
+// poll取り消し用SQEの完了は読み捨てる
+static const unsigned long long k_cancel_user_data = 0;
+
+Multiplexer &IoUringMultiplexer::get_instance() {
+  if (!Multiplexer::instance_) {
+    try {
+      Multiplexer::instance_ = new IoUringMultiplexer();
+    } catch (const std::exception &e) {
+      LOG(LOG_WARNING, std::string("io_uring is not available (") + e.what() +
+                           "); falling back to epoll");
+      return EpollMultiplexer::get_instance();
+    }
+    LOG(LOG_INFO, "IoUringMultiplexer::get_instance()");
+    std::atexit(Multiplexer::delete_instance);
+  }
+  return *Multiplexer::instance_;
+}
+
+void IoUringMultiplexer::run() {
+  LOG_DEBUG_FUNC();
+
+  while (true) {
+    handle_timeouts();
+    if (!submit_and_wait(k_timeout_ms_)) {
+      continue;
+    }
+    reap_completions();
+
+    for (size_t i = 0; i < completions_.size(); ++i) {
+      const Completion &c = completions_[i];
+      WatchIt it = watches_.find(c.fd);
+      if (it == watches_.end() || it->second.armed != c.user_data) {
+        continue; // 処理中に監視が外れた / 変わった
+      }
+      it->second.armed = 0; // one-shotなので、処理後に登録し直す
+      rearm_.push_back(c.fd);
+      if (c.res < 0) {
+        LOG_FD(LOG_WARNING, "io_uring poll failed on fd: ", c.fd);
+        continue;
+      }
+      process_event(c.fd, c.res & (POLLIN | POLLHUP | POLLERR),
+                    c.res & POLLOUT);
+    }
+    completions_.clear();
+
+    for (size_t i = 0; i < rearm_.size(); ++i) {
+      WatchIt it = watches_.find(rearm_[i]);
+      if (it != watches_.end() && it->second.armed == 0) {
+        arm(it->first, it->second);
+      }
+    }
+    rearm_.clear();
+    retry_deferred();
+  }
+}
+
+void IoUringMultiplexer::monitor_read(int fd) {
+  LOG_DEBUG_FUNC_FD(fd);
+  set_mask(fd, POLLIN);
+}
+
+void IoUringMultiplexer::monitor_write(int fd) {
+  LOG_DEBUG_FUNC_FD(fd);
+  set_mask(fd, POLLIN | POLLOUT);
+}
+
+void IoUringMultiplexer::unmonitor_write(int fd) {
+  LOG_DEBUG_FUNC_FD(fd);
+  set_mask(fd, POLLIN);
+}
+
+void IoUringMultiplexer::unmonitor(int fd) {
+  LOG_DEBUG_FUNC_FD(fd);
+  set_mask(fd, 0);
+}
+
+void IoUringMultiplexer::monitor_pipe_read(int fd) { monitor_read(fd); }
+
+void IoUringMultiplexer::unmonitor_pipe_read(int fd) { unmonitor(fd); }
+
+void IoUringMultiplexer::monitor_pipe_write(int fd) {
+  LOG_DEBUG_FUNC_FD(fd);
+  set_mask(fd, POLLOUT);
+}
+
+// maskが変わったら、登録中のpollを取り消して登録し直す (0は監視の解除)
+void IoUringMultiplexer::set_mask(int fd, unsigned mask) {
+  WatchIt it = watches_.find(fd);
+  if (mask == 0) {
+    if (it == watches_.end()) {
+      LOG_FD(LOG_WARNING, "fd already erased: ", fd);
+      return;
+    }
+    cancel(it->second);
+    watches_.erase(it);
+    return;
+  }
+  if (it == watches_.end()) {
+    Watch watch;
+    watch.mask = mask;
+    watch.armed = 0;
+    it = watches_.insert(std::make_pair(fd, watch)).first;
+  } else if (it->second.mask == mask) {
+    return;
+  } else {
+    it->second.mask = mask;
+    cancel(it->second);
+  }
+  arm(fd, it->second);
+}
+
+void IoUringMultiplexer::arm(int fd, Watch &watch) {
+  if (++generation_ == 0) {
+    generation_ = 1; // 0 は取り消し用
+  }
+  struct io_uring_sqe *sqe = get_sqe();
+  if (!sqe) {
+    watch.armed = 0;
+    deferred_arms_.push_back(fd);
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = watch.mask;
+  sqe->user_data = make_user_data(generation_, fd);
+  watch.armed = sqe->user_data;
+}
+
+void IoUringMultiplexer::cancel(Watch &watch) {
+  if (watch.armed == 0) {
+    return;
+  }
+  unsigned long long armed = watch.armed;
+  watch.armed = 0; // 取り消しが遅れても、古いpollの完了はarmedと食い違うので無視される
+  struct io_uring_sqe *sqe = get_sqe();
+  if (!sqe) {
+    deferred_cancels_.push_back(armed);
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = armed;
+  sqe->user_data = k_cancel_user_data;
+}
+
+// SQが一杯で控えていた取り消しと登録を、空いた分だけ投入し直す
+void IoUringMultiplexer::retry_deferred() {
+  size_t done = 0;
+  for (; done < deferred_cancels_.size(); ++done) {
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe) {
+      break;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = deferred_cancels_[done];
+    sqe->user_data = k_cancel_user_data;
+  }
+  deferred_cancels_.erase(deferred_cancels_.begin(),
+                          deferred_cancels_.begin() + done);
+
+  std::vector<int> arms;
+  arms.swap(deferred_arms_); // arm() が失敗すれば deferred_arms_ に積み直す
+  for (size_t i = 0; i < arms.size(); ++i) {
+    WatchIt it = watches_.find(arms[i]);
+    if (it != watches_.end() && it->second.armed == 0) {
+      arm(it->first, it->second);
+    }
+  }
+}
+
+// SQが一杯なら、溜まっている分を待たずに投入してから空きを使う
+// それでも空かなければNULL (呼び出し側が控えて、次の周回で登録し直す)
+struct io_uring_sqe *IoUringMultiplexer::get_sqe() {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  unsigned tail = *sq_tail_;
+  if (tail - head >= sq_entries_) {
+    int submitted = io_uring_enter(ring_fd_, to_submit_, 0, 0, NULL, 0);
+    if (submitted > 0) {
+      to_submit_ -= submitted;
+    }
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (tail - head >= sq_entries_) {
+      LOG(LOG_WARNING, "io_uring submission queue is full; deferring");
+      return NULL;
+    }
+  }
+  unsigned index = tail & sq_mask_;
+  struct io_uring_sqe *sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++to_submit_;
+  return sqe;
+}
+
+// 溜まったSQEの投入と、完了待ち (timeout付き) を1回のsystem callで行う
+bool IoUringMultiplexer::submit_and_wait(int timeout_ms) {
+  struct __kernel_timespec ts;
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+  struct io_uring_getevents_arg arg;
+  std::memset(&arg, 0, sizeof(arg));
+  arg.sigmask_sz = _NSIG / 8;
+  arg.ts = reinterpret_cast<unsigned long long>(&ts);
+
+  errno = 0;
+  int submitted =
+      io_uring_enter(ring_fd_, to_submit_, 1,
+                     IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                     sizeof(arg));
+  if (submitted < 0) {
+    if (errno == ETIME || errno == EINTR) {
+      return false;
+    }
+    if (errno == EBUSY) {
+      return true; // CQが溢れている; 先に読み出す
+    }
+    throw std::runtime_error("io_uring_enter() failed");
+  }
+  to_submit_ -= submitted;
+  return true;
+}
+
+void IoUringMultiplexer::reap_completions() {
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe &cqe = cqes_[head & cq_mask_];
+    if (cqe.user_data == k_cancel_user_data) {
+      continue;
+    }
+    Completion c;
+    c.fd = user_data_fd(cqe.user_data);
+    c.user_data = cqe.user_data;
+    c.res = cqe.res;
+    completions_.push_back(c);
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+void IoUringMultiplexer::setup_ring() {
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  ring_fd_ = io_uring_setup(k_ring_entries, &params);
+  if (ring_fd_ == -1) {
+    throw std::runtime_error("io_uring_setup() failed");
+  }
+  // timeout付きの待機 (IORING_ENTER_EXT_ARG) に Linux 5.11 以降が必要
+  if (!(params.features & IORING_FEAT_EXT_ARG) ||
+      !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    throw std::runtime_error("kernel lacks IORING_FEAT_EXT_ARG");
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (cq_ring_size_ > sq_ring_size_) {
+    sq_ring_size_ = cq_ring_size_;
+  }
+  // SINGLE_MMAP: SQ ringとCQ ringは同じ領域
+  sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    sq_ring_ = NULL;
+    throw std::runtime_error("mmap() of io_uring rings failed");
+  }
+  cq_ring_ = sq_ring_;
+  cq_ring_size_ = 0;
+
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    throw std::runtime_error("mmap() of io_uring SQEs failed");
+  }
+  sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(sq_ring_);
+  sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_entries_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+  sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+  char *cq = static_cast<char *>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+}
+
+IoUringMultiplexer::IoUringMultiplexer()
+    : ring_fd_(-1), sq_ring_(NULL), sq_ring_size_(0), cq_ring_(NULL),
+      cq_ring_size_(0), sqes_(NULL), sqes_size_(0), sq_head_(NULL),
+      sq_tail_(NULL), sq_mask_(0), sq_entries_(0), sq_array_(NULL),
+      cq_head_(NULL), cq_tail_(NULL), cq_mask_(0), cqes_(NULL), to_submit_(0),
+      generation_(0) {
+  try {
+    setup_ring();
+  } catch (...) {
+    release_ring(); // constructorが失敗するとdestructorは呼ばれない
+    throw;
+  }
+}
+
+IoUringMultiplexer::IoUringMultiplexer(const IoUringMultiplexer &other)
+    : Multiplexer(other) {}
+
+IoUringMultiplexer::~IoUringMultiplexer() { release_ring(); }
+
+void IoUringMultiplexer::release_ring() {
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+    sqes_ = NULL;
+  }
+  if (sq_ring_) {
+    munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = NULL;
+  }
+  if (ring_fd_ != -1) {
+    close(ring_fd_);
+    ring_fd_ = -1;
+  }
+}
+
+IoUringMultiplexer &
+IoUringMultiplexer::operator=(const IoUringMultiplexer &other) {
+  (void)other;
+  return *this;
+}
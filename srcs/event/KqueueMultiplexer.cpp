@@ -8,7 +8,7 @@
 
 Multiplexer &KqueueMultiplexer::get_instance() {
   if (!Multiplexer::instance_) {
-    log(LOG_INFO, "KqueueMultiplexer::get_instance()");
+    LOG(LOG_INFO, "KqueueMultiplexer::get_instance()");
     Multiplexer::instance_ = new KqueueMultiplexer();
     std::atexit(Multiplexer::delete_instance);
   }
@@ -37,7 +37,7 @@ void KqueueMultiplexer::run() {
       if (errno == EINTR) {
         continue;
       }
-      log(LOG_ERROR, "kqueue() is not working: "); // errno出す
+      LOG(LOG_ERROR, "kqueue() is not working: "); // errno出す
       throw std::runtime_error("kqueue() failed");
     }
 
@@ -84,6 +84,13 @@ void KqueueMultiplexer::monitor_pipe_read(int fd) { monitor_read(fd); }
 
 void KqueueMultiplexer::monitor_pipe_write(int fd) { monitor_write(fd); }
 
+void KqueueMultiplexer::unmonitor_pipe_read(int fd) {
+  LOG_DEBUG_FUNC_FD(fd);
+  struct kevent delete_ev;
+  EV_SET(&delete_ev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  change_list.push_back(delete_ev);
+}
+
 bool KqueueMultiplexer::is_readable(struct kevent &ev) const {
   return (ev.filter == EVFILT_READ);
 }
@@ -11,14 +11,18 @@
 /* ************************************************************************** */
 
 #include "Multiplexer.hpp"
+#include "AccessLog.hpp"
 #include "CgiRegistry.hpp"
 #include "CgiSession.hpp"
+#include "ChildReaper.hpp"
 #include "Client.hpp"
 #include "ClientRegistry.hpp"
 #include "ConnectionManager.hpp"
 #include "EpollMultiplexer.hpp"
+#include "IoUringMultiplexer.hpp"
 #include "KqueueMultiplexer.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
 #include "PollMultiplexer.hpp"
 #include "SelectMultiplexer.hpp"
 #include "ServerRegistry.hpp"
@@ -30,10 +34,33 @@
 
 Multiplexer *Multiplexer::instance_ = 0;
 
+std::string Multiplexer::backend_;
+
 const int Multiplexer::k_timeout_ms_ = 1000;
+const int Multiplexer::k_default_stall_threshold_ms_ = 100;
+
+// accept_client() 1回で受け付ける接続数の上限
+static const int k_max_accepts_per_event = 64;
+
+// process_events() で、後のphaseに回す処理
+static const unsigned char k_pending_process = 1; // 受信したdataのparse
+static const unsigned char k_pending_flush = 2;   // 応答の送信
+
 
 Multiplexer &Multiplexer::get_instance() {
+  if (instance_) {
+    return *instance_;
+  }
+  if (backend_ == "poll") {
+    return PollMultiplexer::get_instance();
+  }
+  if (backend_ == "select") {
+    return SelectMultiplexer::get_instance();
+  }
 #if defined(__linux__)
+  if (backend_ == "io_uring") {
+    return IoUringMultiplexer::get_instance();
+  }
   return EpollMultiplexer::get_instance();
 #elif defined(__APPLE__) || defined(__MACH__)
   return KqueueMultiplexer::get_instance();
@@ -46,6 +73,20 @@ Multiplexer &Multiplexer::get_instance() {
 #endif
 }
 
+bool Multiplexer::set_backend(const std::string &name) {
+  bool supported = name == "poll" || name == "select";
+#if defined(__linux__)
+  supported = supported || name == "epoll" || name == "io_uring";
+#elif defined(__APPLE__) || defined(__MACH__) || defined(__FreeBSD__) ||       \
+    defined(__OpenBSD__)
+  supported = supported || name == "kqueue";
+#endif
+  if (supported) {
+    backend_ = name;
+  }
+  return supported;
+}
+
 void Multiplexer::delete_instance() {
   if (instance_) {
     delete instance_;
@@ -65,6 +106,12 @@ void Multiplexer::set_cgi_registry(CgiRegistry *registry) {
   cgi_registry_ = registry;
 }
 
+// SIGCHLDの通知fdを、他のfdと同じようにevent loopで監視する
+void Multiplexer::set_child_reaper(ChildReaper *reaper) {
+  child_reaper_ = reaper;
+  monitor_read(reaper->get_fd());
+}
+
 void Multiplexer::register_cgi_fd(int fd, CgiSession *session) {
   cgi_registry_->add(fd, session);
 }
@@ -73,13 +120,22 @@ void Multiplexer::process_event(int fd, bool readable, bool writable) {
   if (!readable && !writable) {
     return;
   }
+  unsigned long long started = begin_handler();
   if (server_registry_->has(fd)) {
     if (readable) {
       accept_client(fd);
     }
+    end_handler(fd, "accept", started);
     return;
   }
+  if (child_reaper_ && fd == child_reaper_->get_fd()) {
+    reap_children();
+    end_handler(fd, "reap", started);
+    return;
+  }
+  const char *phase = "event";
   if (client_registry_->has(fd)) {
+    phase = readable ? "read" : "write"; // readはparseと応答の生成を含む
     if (readable) {
       read_from_client(fd);
     }
@@ -88,6 +144,7 @@ void Multiplexer::process_event(int fd, bool readable, bool writable) {
     }
   }
   if (cgi_registry_->has(fd)) {
+    phase = "cgi";
     if (readable) {
       read_from_cgi(fd);
     }
@@ -95,53 +152,243 @@ void Multiplexer::process_event(int fd, bool readable, bool writable) {
       write_to_cgi(fd);
     }
   }
+  end_handler(fd, phase, started);
+}
+
+// process_event() を1件ずつ呼ぶ代わりに、全eventを次の順で処理する
+// 1. accept  2. 受信 (とCGIのpipe I/O)  3. parseと応答の生成
+// 4. 送信: 応答ができた接続と書き込み可能な接続に、1回ずつwritev
+// 応答を生成した周回のうちに送るので、write監視の登録と通知待ちを省ける
+void Multiplexer::process_events(const std::vector<ReadyEvent> &events) {
+  LoopStats &last = last_loop_stats_;
+  last = LoopStats();
+  last.iterations = 1;
+  last.events = events.size();
+  pending_.assign(events.size(), 0);
+
+  unsigned long long start = Metrics::now_usec();
+  for (size_t i = 0; i < events.size(); ++i) {
+    if (events[i].readable && server_registry_->has(events[i].fd)) {
+      unsigned long long started = begin_handler();
+      accept_client(events[i].fd);
+      end_handler(events[i].fd, "accept", started);
+      ++last.handled[PHASE_ACCEPT];
+    }
+  }
+
+  unsigned long long end = Metrics::now_usec();
+  last.usec[PHASE_ACCEPT] = end - start;
+  start = end;
+  for (size_t i = 0; i < events.size(); ++i) {
+    const ReadyEvent &ev = events[i];
+    if (!ev.readable && !ev.writable) {
+      continue;
+    }
+    if (server_registry_->has(ev.fd)) {
+      continue;
+    }
+    unsigned long long started = begin_handler();
+    if (child_reaper_ && ev.fd == child_reaper_->get_fd()) {
+      reap_children();
+      end_handler(ev.fd, "reap", started);
+      continue;
+    }
+    if (client_registry_->has(ev.fd)) {
+      if (ev.readable && receive_from_client(ev.fd)) {
+        pending_[i] |= k_pending_process;
+        ++last.handled[PHASE_READ];
+      }
+      if (ev.writable) {
+        pending_[i] |= k_pending_flush;
+      }
+      end_handler(ev.fd, "read", started);
+      continue;
+    }
+    if (cgi_registry_->has(ev.fd)) {
+      if (ev.readable) {
+        read_from_cgi(ev.fd);
+      }
+      if (ev.writable) {
+        write_to_cgi(ev.fd);
+      }
+      ++last.handled[PHASE_READ];
+    }
+    end_handler(ev.fd, "cgi", started);
+  }
+
+  end = Metrics::now_usec();
+  last.usec[PHASE_READ] = end - start;
+  start = end;
+  for (size_t i = 0; i < events.size(); ++i) {
+    if (!(pending_[i] & k_pending_process)) {
+      continue;
+    }
+    unsigned long long started = begin_handler();
+    if (process_client(events[i].fd)) {
+      pending_[i] |= k_pending_flush;
+    }
+    end_handler(events[i].fd, "process", started);
+    ++last.handled[PHASE_PROCESS];
+  }
+
+  end = Metrics::now_usec();
+  last.usec[PHASE_PROCESS] = end - start;
+  start = end;
+  for (size_t i = 0; i < events.size(); ++i) {
+    if (pending_[i] & k_pending_flush) {
+      unsigned long long started = begin_handler();
+      flush_client(events[i].fd, events[i].writable);
+      end_handler(events[i].fd, "flush", started);
+      ++last.handled[PHASE_FLUSH];
+    }
+  }
+  last.usec[PHASE_FLUSH] = Metrics::now_usec() - start;
+
+  loop_stats_.iterations += last.iterations;
+  loop_stats_.events += last.events;
+  for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+    loop_stats_.handled[phase] += last.handled[phase];
+    loop_stats_.usec[phase] += last.usec[phase];
+  }
+  if (is_log_enabled(LOG_FUNC)) {
+    log_loop_stats();
+  }
+}
+
+const LoopStats &Multiplexer::get_loop_stats() const { return loop_stats_; }
+
+void Multiplexer::set_stall_threshold_ms(int ms) {
+  stall_threshold_usec_ = ms > 0 ? ms * 1000ULL : 0;
+}
+
+unsigned long long Multiplexer::begin_handler() {
+  Metrics::get_instance().reset_slowest_op();
+  return Metrics::now_usec();
+}
+
+void Multiplexer::end_handler(int fd, const char *phase,
+                              unsigned long long started) {
+  unsigned long long usec = Metrics::now_usec() - started;
+  busy_usec_ += usec;
+  if (stall_threshold_usec_ != 0 && usec >= stall_threshold_usec_) {
+    report_stall(fd, phase, usec);
+  }
+}
+
+// 処理済みのrequestは解放されているので、接続で最後に解析したrequestを示す
+void Multiplexer::report_stall(int fd, const char *phase,
+                               unsigned long long usec) {
+  Metrics &metrics = Metrics::get_instance();
+  metrics.count_stall();
+
+  int client_fd = fd;
+  if (fd != -1 && cgi_registry_->has(fd)) {
+    CgiSession *session = cgi_registry_->get(fd);
+    client_fd = session->get_client_fd();
+  }
+  Client *client = client_fd != -1 ? client_registry_->get(client_fd) : NULL;
+
+  std::ostringstream oss;
+  oss << "[STALL] " << phase << " blocked the event loop for "
+      << static_cast<double>(usec) / 1000 << "ms fd=" << fd;
+  if (client && !client->get_request_line().empty()) {
+    oss << " last_request=\"" << client->get_request_line() << "\"";
+  }
+  if (metrics.get_slowest_op()) {
+    oss << " slowest_op=" << metrics.get_slowest_op() << "/"
+        << static_cast<double>(metrics.get_slowest_op_usec()) / 1000 << "ms";
+  }
+  LOG(LOG_WARNING, oss.str());
+}
+
+const LoopStats &Multiplexer::get_last_loop_stats() const {
+  return last_loop_stats_;
+}
+
+void Multiplexer::log_loop_stats() const {
+  static const char *names[PHASE_COUNT] = {"accept", "read", "process",
+                                           "flush"};
+  std::ostringstream oss;
+  oss << "[LOOP] events=" << last_loop_stats_.events;
+  for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+    oss << " " << names[phase] << "=" << last_loop_stats_.handled[phase] << "/"
+        << last_loop_stats_.usec[phase] << "us";
+  }
+  LOG(LOG_FUNC, oss.str());
 }
 
 void Multiplexer::handle_timeouts() {
+  Metrics &metrics = Metrics::get_instance();
+  metrics.count_loop_iteration(); // 全backendで、待機の前に1周1回呼ばれる
+  if (busy_usec_ != 0) {
+    metrics.observe_loop(busy_usec_); // 前の周回でeventの処理に使った時間
+    busy_usec_ = 0;
+  }
+  unsigned long long started = begin_handler();
+  time_t now = time(NULL);
+  AccessLog::get_instance().flush_if_due(now);
+
   std::set<int> timed_out_cgi_clients = cgi_registry_->mark_timed_outs();
+  metrics.count_timeouts(Metrics::TIMEOUT_CGI, timed_out_cgi_clients.size());
 
   for (std::set<int>::const_iterator it = timed_out_cgi_clients.begin();
        it != timed_out_cgi_clients.end(); ++it) {
-    logfd(LOG_INFO, "[TIMEOUT] monitor_write after CGI timeout fd=", *it);
+    LOG_FD(LOG_INFO, "[TIMEOUT] monitor_write after CGI timeout fd=", *it);
     monitor_write(*it);
   }
 
   std::vector<int> timed_out_fds = client_registry_->mark_timed_out_clients();
+  metrics.count_timeouts(Metrics::TIMEOUT_CLIENT, timed_out_fds.size());
 
   for (size_t i = 0; i < timed_out_fds.size(); ++i) {
-    logfd(LOG_INFO,
+    LOG_FD(LOG_INFO,
           "[TIMEOUT] monitor_write after timeout fd=", timed_out_fds[i]);
     monitor_write(timed_out_fds[i]);
   }
 
   std::vector<int> unresponsive_fds =
       client_registry_->detect_unresponsive_clients();
+  metrics.count_timeouts(Metrics::TIMEOUT_UNRESPONSIVE,
+                         unresponsive_fds.size());
 
   for (size_t i = 0; i < unresponsive_fds.size(); ++i) {
-    logfd(LOG_INFO,
+    LOG_FD(LOG_INFO,
           "[TIMEOUT] forcibly removing unresponsive fd=", unresponsive_fds[i]);
     cleanup_client(unresponsive_fds[i]);
   }
+  end_handler(-1, "timeouts", started);
 }
 
-Multiplexer::Multiplexer() {}
+Multiplexer::Multiplexer()
+    : server_registry_(NULL), client_registry_(NULL), cgi_registry_(NULL),
+      child_reaper_(NULL), pending_(), loop_stats_(), last_loop_stats_(),
+      stall_threshold_usec_(k_default_stall_threshold_ms_ * 1000ULL),
+      busy_usec_(0) {}
 
 Multiplexer::Multiplexer(const Multiplexer &other) { (void)other; }
 
 Multiplexer::~Multiplexer() {}
 
+// 1回の通知でbacklogに溜まった接続をまとめて受け付ける
+// 他のfdを待たせないよう、k_max_accepts_per_event 件で打ち切る
+// (残りはlevel-triggeredの次の通知で受け付ける)
 void Multiplexer::accept_client(int serverfd) {
   LOG_DEBUG_FUNC_FD(serverfd);
-  int clientfd = ConnectionManager::accept_new_connection(serverfd);
-  if (clientfd == -1) {
-    log(LOG_DEBUG, "Failed to process new connection");
-    return;
+  const VirtualHostRouter *router = server_registry_->get_router(serverfd);
+  const ListenOptions *found = server_registry_->get_listen_options(serverfd);
+  const ListenOptions options = found ? *found : ListenOptions();
+
+  for (int i = 0; i < k_max_accepts_per_event; ++i) {
+    int clientfd = ConnectionManager::accept_new_connection(serverfd);
+    if (clientfd == -1) {
+      return; // backlogが空, あるいはerror
+    }
+    Metrics::get_instance().count_accept();
+    Client *client = Client::create(clientfd, router, options);
+    client_registry_->add(clientfd, client);
+    monitor_read(clientfd);
+    LOG_FD(LOG_DEBUG, "New connection on client socket: ", clientfd);
   }
-
-  Client *client = new Client(clientfd, server_registry_->get_router(serverfd));
-  client_registry_->add(clientfd, client);
-  monitor_read(clientfd);
-  logfd(LOG_DEBUG, "New connection on client socket: ", clientfd);
 }
 
 void Multiplexer::read_from_client(int clientfd) {
@@ -162,7 +409,7 @@ void Multiplexer::read_from_client(int clientfd) {
     cleanup_client(clientfd);
     break;
   default:
-    logfd(LOG_ERROR, "Unhandled I/O Status on client socket: ", clientfd);
+    LOG_FD(LOG_ERROR, "Unhandled I/O Status on client socket: ", clientfd);
     cleanup_client(clientfd);
   }
 }
@@ -187,7 +434,77 @@ void Multiplexer::write_to_client(int clientfd) {
     cleanup_client(clientfd);
     break;
   default:
-    logfd(LOG_ERROR, "Unhandled I/O Status on client socket: ", clientfd);
+    LOG_FD(LOG_ERROR, "Unhandled I/O Status on client socket: ", clientfd);
+    cleanup_client(clientfd);
+  }
+}
+
+// 受信だけ行う; parseすべきdataを受け取ったらtrue
+bool Multiplexer::receive_from_client(int clientfd) {
+  LOG_DEBUG_FUNC_FD(clientfd);
+  Client *client = client_registry_->get(clientfd);
+  if (!client) {
+    return false;
+  }
+  if (client->receive() == IO_SHOULD_CLOSE) {
+    cleanup_client(clientfd);
+    return false;
+  }
+  return true;
+}
+
+// parseと応答の生成; 送る応答があればtrue
+bool Multiplexer::process_client(int clientfd) {
+  LOG_DEBUG_FUNC_FD(clientfd);
+  Client *client = client_registry_->get(clientfd);
+  if (!client) {
+    return false;
+  }
+
+  switch (client->process_received()) {
+  case IO_CONTINUE:
+    return false;
+  case IO_READY_TO_WRITE:
+    return true;
+  case IO_SHOULD_CLOSE:
+    cleanup_client(clientfd);
+    return false;
+  default:
+    LOG_FD(LOG_ERROR, "Unhandled I/O Status on client socket: ", clientfd);
+    cleanup_client(clientfd);
+    return false;
+  }
+}
+
+// write監視を経ずに送る; 送りきれなかった場合だけwrite監視に回す
+// 送り残しがあって書き込み可能の通知を待っている間は、先回りして書かない
+// (socketのbufferが空いていないので、writevは-1になる)
+void Multiplexer::flush_client(int clientfd, bool write_monitored) {
+  LOG_DEBUG_FUNC_FD(clientfd);
+  Client *client = client_registry_->get(clientfd);
+  if (!client || (!write_monitored && client->is_awaiting_writable())) {
+    return;
+  }
+
+  switch (client->on_write()) {
+  case IO_CONTINUE:
+    if (!write_monitored) {
+      monitor_write(clientfd);
+    }
+    break;
+  case IO_WRITE_COMPLETE:
+    if (write_monitored) {
+      unmonitor_write(clientfd);
+    }
+    break;
+  case IO_SHOULD_SHUTDOWN:
+    shutdown_write(clientfd);
+    break;
+  case IO_SHOULD_CLOSE:
+    cleanup_client(clientfd);
+    break;
+  default:
+    LOG_FD(LOG_ERROR, "Unhandled I/O Status on client socket: ", clientfd);
     cleanup_client(clientfd);
   }
 }
@@ -195,7 +512,7 @@ void Multiplexer::write_to_client(int clientfd) {
 void Multiplexer::shutdown_write(int clientfd) {
   LOG_DEBUG_FUNC_FD(clientfd);
   if (shutdown(clientfd, SHUT_WR) == -1) {
-    logfd(LOG_ERROR, "shutdown() failed for fd: ", clientfd);
+    LOG_FD(LOG_ERROR, "shutdown() failed for fd: ", clientfd);
     cleanup_client(clientfd);
     return;
   }
@@ -215,20 +532,40 @@ void Multiplexer::read_from_cgi(int cgi_stdout) {
     return;
   }
 
-  switch (session->on_cgi_read()) {
+  CgiIOStatus status = session->on_cgi_read();
+  // cleanup_cgi() でsessionがpoolに戻りうるので、通知先を先に控える
+  int clientfd = session->is_client_alive() ? session->get_client_fd() : -1;
+
+  switch (status) {
   case CGI_IO_CONTINUE:
     // Do nothing
     break;
+  case CGI_IO_RELAYED:
+    // client socketへ直接送信済みなので、write監視は不要
+    if (clientfd != -1) {
+      Client *client = client_registry_->get(clientfd);
+      if (client) {
+        client->on_cgi_relay();
+      }
+    }
+    return;
   case CGI_IO_READ_COMPLETE:
   case CGI_IO_ERROR:
     cleanup_cgi(cgi_stdout);
     break;
+  case CGI_IO_SHOULD_CLOSE:
+    // spliceでclientの切断が分かった; Clientの後始末でsessionも解放される
+    cleanup_cgi(cgi_stdout);
+    if (clientfd != -1) {
+      cleanup_client(clientfd);
+    }
+    return;
   default:
-    logfd(LOG_ERROR, "Unhandled I/O Status on cgi stdout fd: ", cgi_stdout);
+    LOG_FD(LOG_ERROR, "Unhandled I/O Status on cgi stdout fd: ", cgi_stdout);
     break;
   }
-  if (session->is_client_alive()) {
-    monitor_write(session->get_client_fd());
+  if (clientfd != -1) {
+    monitor_write(clientfd);
   }
 }
 
@@ -239,25 +576,60 @@ void Multiplexer::write_to_cgi(int cgi_stdin) {
     return;
   }
 
+  // cleanup_cgi() でsessionがpoolに戻りうるので、stdoutのfdを先に控える
+  int cgi_stdout = session->get_stdout_fd();
+
   switch (session->on_cgi_write()) {
   case CGI_IO_CONTINUE:
     // Do nothing
     break;
   case CGI_IO_WRITE_COMPLETE:
+    if (cgi_stdout == cgi_stdin) {
+      // FastCGI: 同じsocketのまま、応答の読み込みに切り替える
+      unmonitor(cgi_stdin);
+      monitor_pipe_read(cgi_stdin);
+      break;
+    }
+    // stdoutを先に登録し、stdinの片付けでsessionが解放されないようにする
+    register_cgi_fd(cgi_stdout, session);
+    monitor_pipe_read(cgi_stdout);
     cleanup_cgi(cgi_stdin);
-    register_cgi_fd(session->get_stdout_fd(), session);
-    monitor_pipe_read(session->get_stdout_fd());
     break;
   case CGI_IO_ERROR:
     cleanup_cgi(cgi_stdin);
-    cleanup_cgi(session->get_stdout_fd());
+    if (cgi_stdout != -1) {
+      cleanup_cgi(cgi_stdout);
+    }
     break;
   default:
-    logfd(LOG_ERROR, "Unhandled I/O Status on cgi stdin fd: ", cgi_stdin);
+    LOG_FD(LOG_ERROR, "Unhandled I/O Status on cgi stdin fd: ", cgi_stdin);
     break;
   }
 }
 
+// 終了した子processを回収し、対応するCgiSessionに終了statusを渡す
+void Multiplexer::reap_children() {
+  LOG_DEBUG_FUNC();
+  child_reaper_->drain();
+
+  pid_t pid;
+  int status;
+  while (child_reaper_->reap(pid, status)) {
+    LOG_FD(LOG_DEBUG, "[SIGCHLD] Reaped child pid: ", pid);
+    CgiSession *session = cgi_registry_->find_by_pid(pid);
+    if (!session) {
+      CgiSession::log_exit(pid, status, NULL); // 応答済みのCGIの終了
+      continue;
+    }
+    // on_cgi_exit() の中でsessionが破棄され得るので、先に控えておく
+    bool client_alive = session->is_client_alive();
+    int client_fd = session->get_client_fd();
+    if (session->on_cgi_exit(status) && client_alive) {
+      monitor_write(client_fd); // pipeのEOFを待たずにerror応答を返す
+    }
+  }
+}
+
 void Multiplexer::cleanup_cgi(int cgi_fd) {
   unmonitor(cgi_fd);
   cgi_registry_->remove(cgi_fd);
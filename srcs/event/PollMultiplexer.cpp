@@ -9,7 +9,7 @@
 
 Multiplexer &PollMultiplexer::get_instance() {
   if (!Multiplexer::instance_) {
-    log(LOG_INFO, "PollMultiplexer::get_instance()");
+    LOG(LOG_INFO, "PollMultiplexer::get_instance()");
     Multiplexer::instance_ = new PollMultiplexer();
     std::atexit(Multiplexer::delete_instance);
   }
@@ -38,9 +38,15 @@ void PollMultiplexer::run() {
       throw std::runtime_error("poll() failed");
     }
 
-    PollFdVec tmp = pfds;
-    for (size_t i = 0; i < tmp.size(); ++i) {
-      process_event(tmp[i].fd, is_readable(tmp[i]), is_writable(tmp[i]));
+    // 準備のできたnfd個を見つけたら、残りは走査しない
+    ready.clear();
+    for (size_t i = 0; i < pfds.size() && ready.size() < (size_t)nfd; ++i) {
+      if (pfds[i].revents != 0) {
+        ready.push_back(pfds[i]);
+      }
+    }
+    for (size_t i = 0; i < ready.size(); ++i) {
+      process_event(ready[i].fd, is_readable(ready[i]), is_writable(ready[i]));
     }
   }
 }
@@ -52,15 +58,11 @@ void PollMultiplexer::monitor_read(int fd) {
     if (it->events & POLLIN) {
       return;
     }
-    logfd(LOG_WARNING, "fd found, adding missing read event (POLLIN): ", fd);
+    LOG_FD(LOG_WARNING, "fd found, adding missing read event (POLLIN): ", fd);
     it->events |= POLLIN;
     return;
   }
-  struct pollfd pfd;
-  pfd.fd = fd;
-  pfd.events = POLLIN;
-  pfd.revents = 0;
-  pfds.push_back(pfd);
+  add_pollfd(fd, POLLIN);
 }
 
 void PollMultiplexer::monitor_write(int fd) {
@@ -73,22 +75,19 @@ void PollMultiplexer::monitor_write(int fd) {
     it->events |= POLLOUT;
     return;
   }
-  logfd(LOG_WARNING, "fd not in read monitor. Adding it now: ", fd);
-  struct pollfd pfd;
-  pfd.fd = fd;
-  pfd.events = POLLIN | POLLOUT;
-  pfds.push_back(pfd);
+  LOG_FD(LOG_WARNING, "fd not in read monitor. Adding it now: ", fd);
+  add_pollfd(fd, POLLIN | POLLOUT);
 }
 
 void PollMultiplexer::unmonitor_write(int fd) {
   LOG_DEBUG_FUNC_FD(fd);
   PollFdIt it = find_pollfd(fd);
   if (it == pfds.end()) {
-    logfd(LOG_WARNING, "fd doesn't exist in pfds vector: ", fd);
+    LOG_FD(LOG_WARNING, "fd doesn't exist in pfds vector: ", fd);
     return;
   }
   if (!(it->events & POLLOUT)) {
-    logfd(LOG_WARNING, "fd is already delisted from write monitor: ", fd);
+    LOG_FD(LOG_WARNING, "fd is already delisted from write monitor: ", fd);
     return;
   }
   it->events &= ~POLLOUT;
@@ -99,14 +98,20 @@ void PollMultiplexer::unmonitor(int fd) {
 
   PollFdIt it = find_pollfd(fd);
   if (it == pfds.end()) {
-    logfd(LOG_WARNING, "fd already erased: ", fd);
+    LOG_FD(LOG_WARNING, "fd already erased: ", fd);
     return;
   }
-  pfds.erase(it);
+  // 末尾の要素で埋めて、途中の要素を詰める操作を避ける
+  *it = pfds.back();
+  fd_to_index[it->fd] = static_cast<int>(it - pfds.begin());
+  pfds.pop_back();
+  fd_to_index[fd] = -1;
 }
 
 void PollMultiplexer::monitor_pipe_read(int fd) { monitor_read(fd); }
 
+void PollMultiplexer::unmonitor_pipe_read(int fd) { unmonitor(fd); }
+
 void PollMultiplexer::monitor_pipe_write(int fd) {
   LOG_DEBUG_FUNC_FD(fd);
   PollFdIt it = find_pollfd(fd);
@@ -114,14 +119,11 @@ void PollMultiplexer::monitor_pipe_write(int fd) {
     if (it->events & POLLOUT) {
       return;
     }
-    logfd(LOG_WARNING, "fd found, adding missing write event (POLLOUT): ", fd);
+    LOG_FD(LOG_WARNING, "fd found, adding missing write event (POLLOUT): ", fd);
     it->events = POLLOUT;
     return;
   }
-  struct pollfd pfd;
-  pfd.fd = fd;
-  pfd.events = POLLOUT;
-  pfds.push_back(pfd);
+  add_pollfd(fd, POLLOUT);
 }
 
 bool PollMultiplexer::is_readable(struct pollfd pfd) const {
@@ -133,15 +135,27 @@ bool PollMultiplexer::is_writable(struct pollfd pfd) const {
 }
 
 PollMultiplexer::PollFdIt PollMultiplexer::find_pollfd(int fd) {
-  for (PollFdIt it = pfds.begin(); it != pfds.end(); ++it) {
-    if (it->fd == fd) {
-      return it;
-    }
+  if (fd < 0 || static_cast<size_t>(fd) >= fd_to_index.size() ||
+      fd_to_index[fd] == -1) {
+    return pfds.end();
+  }
+  return pfds.begin() + fd_to_index[fd];
+}
+
+void PollMultiplexer::add_pollfd(int fd, short events) {
+  if (static_cast<size_t>(fd) >= fd_to_index.size()) {
+    fd_to_index.resize(fd + 1, -1);
   }
-  return pfds.end();
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = events;
+  pfd.revents = 0;
+  fd_to_index[fd] = static_cast<int>(pfds.size());
+  pfds.push_back(pfd);
 }
 
-PollMultiplexer::PollMultiplexer() : Multiplexer(), pfds() {}
+PollMultiplexer::PollMultiplexer()
+    : Multiplexer(), pfds(), fd_to_index(), ready() {}
 
 PollMultiplexer::PollMultiplexer(const PollMultiplexer &other)
     : Multiplexer(other) {
@@ -9,7 +9,7 @@
 
 Multiplexer &SelectMultiplexer::get_instance() {
   if (!Multiplexer::instance_) {
-    log(LOG_INFO, "SelectMultiplexer::get_instance()");
+    LOG(LOG_INFO, "SelectMultiplexer::get_instance()");
     Multiplexer::instance_ = new SelectMultiplexer();
     std::atexit(Multiplexer::delete_instance);
   }
@@ -83,6 +83,11 @@ void SelectMultiplexer::monitor_pipe_read(int fd) { monitor_read(fd); }
 
 void SelectMultiplexer::monitor_pipe_write(int fd) { monitor_write(fd); }
 
+void SelectMultiplexer::unmonitor_pipe_read(int fd) {
+  LOG_DEBUG_FUNC_FD(fd);
+  FD_CLR(fd, &read_fds);
+}
+
 bool SelectMultiplexer::is_readable(int fd) {
   return FD_ISSET(fd, &active_read_fds);
 }
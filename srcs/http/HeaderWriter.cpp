@@ -0,0 +1,141 @@
+#include "HeaderWriter.hpp"
+#include "HttpResponse.hpp"
+#include <cstring>
+#include <ctime>
+
+static const char k_crlf[] = "\r\n";
+
+HeaderWriter::HeaderWriter(std::vector<char> &out)
+    : out_(&out), buffered_(0) {}
+
+HeaderWriter::~HeaderWriter() { flush(); }
+
+// "HTTP/1.1 404 Not Found\r\n"
+void HeaderWriter::status_line(int status_code) {
+  append("HTTP/1.1 ", 9);
+  append_decimal(static_cast<size_t>(status_code));
+  append(" ", 1);
+  append(HttpResponse::get_status_message(status_code));
+  append(k_crlf, 2);
+}
+
+void HeaderWriter::header(const char *name, const std::string &value) {
+  append(name);
+  append(": ", 2);
+  append(value);
+  append(k_crlf, 2);
+}
+
+void HeaderWriter::header(const char *name, const char *value) {
+  append(name);
+  append(": ", 2);
+  append(value);
+  append(k_crlf, 2);
+}
+
+void HeaderWriter::header(const std::string &name, const std::string &value) {
+  append(name);
+  append(": ", 2);
+  append(value);
+  append(k_crlf, 2);
+}
+
+void HeaderWriter::header(const char *name, size_t value) {
+  append(name);
+  append(": ", 2);
+  append_decimal(value);
+  append(k_crlf, 2);
+}
+
+void HeaderWriter::date_header() {
+  append("Date: ", 6);
+  append(http_date(), k_date_length);
+  append(k_crlf, 2);
+}
+
+void HeaderWriter::connection_header(ConnectionPolicy conn) {
+  if (conn == CP_KEEP_ALIVE) {
+    append("Connection: keep-alive\r\n", 24);
+  } else {
+    append("Connection: close\r\n", 19);
+  }
+}
+
+// header部の終わりの空行; ここまでの内容を out に書き出す
+void HeaderWriter::end() {
+  append(k_crlf, 2);
+  flush();
+}
+
+void HeaderWriter::flush() {
+  if (buffered_ > 0) {
+    out_->insert(out_->end(), buffer_, buffer_ + buffered_);
+    buffered_ = 0;
+  }
+}
+
+// 書き出し前の分も含めた、outの先頭からの長さ
+size_t HeaderWriter::size() const { return out_->size() + buffered_; }
+
+void HeaderWriter::append(const char *data, size_t length) {
+  if (buffered_ + length > k_buffer_size) {
+    flush();
+    if (length > k_buffer_size) {
+      out_->insert(out_->end(), data, data + length); // bodyなどは直接追加
+      return;
+    }
+  }
+  std::memcpy(buffer_ + buffered_, data, length);
+  buffered_ += length;
+}
+
+void HeaderWriter::append(const char *str) { append(str, std::strlen(str)); }
+
+void HeaderWriter::append(const std::string &str) {
+  append(str.data(), str.size());
+}
+
+// 下の桁から一時bufferの後ろ向きに埋める
+void HeaderWriter::append_decimal(size_t value) {
+  char buf[20]; // 2^64 - 1 は20桁
+  size_t pos = sizeof(buf);
+  do {
+    buf[--pos] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  append(buf + pos, sizeof(buf) - pos);
+}
+
+// chunk size行用 (小文字, 先頭の0なし)
+void HeaderWriter::append_hex(size_t value) {
+  static const char k_digits[] = "0123456789abcdef";
+  char buf[16];
+  size_t pos = sizeof(buf);
+  do {
+    buf[--pos] = k_digits[value & 0xf];
+    value >>= 4;
+  } while (value != 0);
+  append(buf + pos, sizeof(buf) - pos);
+}
+
+// 同じ秒の間は、前回整形した日付を返す
+const char *HeaderWriter::http_date() {
+  static time_t cached_time = -1;
+  static char cached_date[k_date_length + 1];
+
+  time_t now = time(NULL);
+  if (now != cached_time) {
+    std::strftime(cached_date, sizeof(cached_date),
+                  "%a, %d %b %Y %H:%M:%S GMT", std::gmtime(&now));
+    cached_time = now;
+  }
+  return cached_date;
+}
+
+HeaderWriter::HeaderWriter(const HeaderWriter &other)
+    : out_(other.out_), buffered_(0) {}
+
+HeaderWriter &HeaderWriter::operator=(const HeaderWriter &other) {
+  (void)other;
+  return *this;
+}
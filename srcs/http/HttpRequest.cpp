@@ -15,20 +15,28 @@
 #include "CgiUtils.hpp"
 #include "HttpResponse.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
 #include "MimeTypes.hpp"
 #include "Multiplexer.hpp"
+#include "ObjectPool.hpp"
 #include "Server.hpp"
 #include "Utils.hpp"
 #include "VirtualHostRouter.hpp"
 
 const size_t HttpRequest::k_default_max_body_ = 104857600;
 
+// server選択前 (と clear() 後) の server_config_ / location_configs_
+static const ConfigMap k_empty_config;
+static const LocationMap k_empty_locations;
+
 HttpRequest::HttpRequest(int fd, const VirtualHostRouter *router,
                          HttpResponse &httpResponse)
-    : is_autoindex_enabled_(false), client_fd_(fd), response_(httpResponse),
-      virtual_host_router_(router), cgi_session_(NULL),
-      connection_policy_(CP_KEEP_ALIVE), status_code_(0),
-      max_body_size_(k_default_max_body_) {}
+    : body_size_(0), is_autoindex_enabled_(false),
+      server_config_(&k_empty_config), location_configs_(&k_empty_locations),
+      client_fd_(fd), response_(httpResponse), virtual_host_router_(router),
+      cgi_session_(NULL), cgi_parser_(NULL), connection_policy_(CP_KEEP_ALIVE),
+      status_code_(0),
+      max_body_size_(k_default_max_body_), routed_at_(0), slow_request_ms_(0) {}
 
 HttpRequest::~HttpRequest() {}
 
@@ -37,8 +45,10 @@ void HttpRequest::select_server_by_host() {
 
   const std::string host_name = get_header_value("Host");
   Server *server = virtual_host_router_->route_by_host(host_name);
-  this->server_config_ = server->get_config();
-  this->location_configs_ = server->get_locations();
+  // configはServerが持ち続けるので、requestごとにコピーしない
+  this->server_config_ = &server->get_config();
+  this->location_configs_ = &server->get_locations();
+  this->slow_request_ms_ = server->get_slow_request_ms();
 }
 
 void HttpRequest::init_cgi_extensions() {
@@ -72,8 +82,9 @@ void HttpRequest::conf_init() {
 
   if (!best_match_config_["root"].empty())
     _root = best_match_config_["root"][0];
-  else if (!server_config_["root"].empty())
-    _root = server_config_["root"][0];
+  else if (server_config_->count("root") &&
+           !server_config_->find("root")->second.empty())
+    _root = server_config_->find("root")->second[0];
   else
     print_error_message("No root found in config file.");
   init_cgi_extensions();
@@ -115,6 +126,7 @@ void HttpRequest::handle_http_request() {
   LOG_DEBUG_FUNC();
   select_server_by_host();
   conf_init();
+  routed_at_ = Metrics::now_usec();
   if (!validate_client_body_size()) {
     handle_error(413);
     return;
@@ -142,7 +154,11 @@ void HttpRequest::handle_http_request() {
   std::vector<std::string>::const_iterator it =
       std::find(allow_methods_.begin(), allow_methods_.end(), method_);
   if (it != allow_methods_.end()) {
-    if (method_ == "GET") {
+    if (is_stub_status_location()) {
+      handle_stub_status();
+    } else if (CgiUtils::is_location_has_fastcgi(best_match_config_)) {
+      launch_fastcgi();
+    } else if (method_ == "GET") {
       handle_get_request(path_);
     } else if (method_ == "POST") {
       handle_post_request();
@@ -165,16 +181,15 @@ ConfigMap HttpRequest::get_best_match_config(const std::string &path) {
 
   ConfigMap best_config;
 
-  best_config = server_config_;
-
-  std::string best_match = "/";
+  best_config = *server_config_;
+  const LocationMap &locations = *location_configs_;
 
+  // NOTE: location名の比較は compare() で行い、substr() の一時stringを作らない
   // 1. 完全一致(= /path) を評価
-  for (ConstLocationIt it = location_configs_.begin();
-       it != location_configs_.end(); ++it) {
+  for (ConstLocationIt it = locations.begin(); it != locations.end(); ++it) {
     const std::string &loc = it->first;
-    if (loc.substr(0, 2) == "= ") {
-      if (loc.substr(2) == path) {
+    if (loc.compare(0, 2, "= ") == 0) {
+      if (loc.compare(2, std::string::npos, path) == 0) {
         merge_config(best_config, it->second);
         return best_config;
       }
@@ -182,24 +197,24 @@ ConfigMap HttpRequest::get_best_match_config(const std::string &path) {
   }
 
   // 2. 最長前方一致を記録（^~ の有無も記録）
-  std::string longest_prefix = "/";
+  size_t longest_prefix = 1; // "/"
   bool has_caret_tilde = false;
-  ConstLocationIt longest_prefix_it = location_configs_.find("/");
+  ConstLocationIt longest_prefix_it = locations.find("/");
 
-  for (ConstLocationIt it = location_configs_.begin();
-       it != location_configs_.end(); ++it) {
+  for (ConstLocationIt it = locations.begin(); it != locations.end(); ++it) {
     const std::string &loc = it->first;
-    if (loc.substr(0, 3) == "^~ ") {
-      std::string clean_loc = loc.substr(3);
-      if (path.find(clean_loc) == 0 &&
-          clean_loc.length() > longest_prefix.length()) {
-        longest_prefix = clean_loc;
+    if (loc.compare(0, 3, "^~ ") == 0) {
+      size_t clean_length = loc.length() - 3;
+      if (path.compare(0, clean_length, loc, 3, clean_length) == 0 &&
+          clean_length > longest_prefix) {
+        longest_prefix = clean_length;
         longest_prefix_it = it;
         has_caret_tilde = true;
       }
-    } else if (loc[0] != '=' && loc[0] != '~' && path.find(loc) == 0 &&
-               loc.length() > longest_prefix.length()) {
-      longest_prefix = loc;
+    } else if (loc[0] != '=' && loc[0] != '~' &&
+               path.compare(0, loc.length(), loc) == 0 &&
+               loc.length() > longest_prefix) {
+      longest_prefix = loc.length();
       longest_prefix_it = it;
     }
   }
@@ -210,10 +225,9 @@ ConfigMap HttpRequest::get_best_match_config(const std::string &path) {
   }
 
   // 3. 正規表現マッチを探す
-  for (ConstLocationIt it = location_configs_.begin();
-       it != location_configs_.end(); ++it) {
+  for (ConstLocationIt it = locations.begin(); it != locations.end(); ++it) {
     const std::string &loc = it->first;
-    if (loc.substr(0, 2) == "~ " || loc.substr(0, 3) == "~* ") {
+    if (loc.compare(0, 2, "~ ") == 0 || loc.compare(0, 3, "~* ") == 0) {
       std::string pattern = loc.substr(loc[1] == '*' ? 3 : 2);
       bool ignore_case = (loc[1] == '*');
       if (regex_match_posix(path, pattern, ignore_case)) {
@@ -224,7 +238,7 @@ ConfigMap HttpRequest::get_best_match_config(const std::string &path) {
   }
 
   // 4. 正規表現マッチがなければ、記録した最長prefixマッチ（^~なし）を使う
-  if (longest_prefix_it != location_configs_.end()) {
+  if (longest_prefix_it != locations.end()) {
     merge_config(best_config, longest_prefix_it->second);
   }
 
@@ -241,12 +255,12 @@ bool HttpRequest::validate_client_body_size() {
   return true;
 }
 void HttpRequest::load_max_body_size() {
-  ConstConfigIt it = server_config_.find("client_max_body_size");
-  if (it != server_config_.end()) {
+  ConstConfigIt it = server_config_->find("client_max_body_size");
+  if (it != server_config_->end()) {
     std::string max_size_str = it->second.front();
     max_body_size_ = str_to_size(max_size_str);
   }
-  logfd(LOG_DEBUG, "client_max_body_size loaded: ", max_body_size_);
+  LOG_FD(LOG_DEBUG, "client_max_body_size loaded: ", max_body_size_);
 }
 
 /*GET Request*/
@@ -294,14 +308,25 @@ ResourceType HttpRequest::get_resource_type(const std::string &path) {
 /*Requestがディレクトリかファイルかの分岐処理*/
 void HttpRequest::handle_file_request(const std::string &file_path) {
   LOG_DEBUG_FUNC();
+  SlowOpScope op("read_file"); // 同期のfile I/O; 大きなfileはevent loopを止める
   std::ifstream file(file_path.c_str(), std::ios::in | std::ios::binary);
   if (!file.is_open()) {
     handle_error(404);
     return;
   }
-  std::istreambuf_iterator<char> begin(file); // fileの先頭
-  std::istreambuf_iterator<char> end;         // EOF
-  std::vector<char> content(begin, end);      // vectorに変換
+  // 先にsizeを調べて1回で確保する (istreambuf_iteratorだと拡張のたびにcopyされる)
+  file.seekg(0, std::ios::end);
+  std::streamoff size = file.tellg();
+  file.seekg(0, std::ios::beg);
+  if (size < 0) {
+    handle_error(500);
+    return;
+  }
+  std::vector<char> content(static_cast<size_t>(size));
+  if (!content.empty() && !file.read(&content[0], size)) {
+    handle_error(500);
+    return;
+  }
 
   std::string mime_type = MimeTypes::get_mime_type(file_path);
 
@@ -383,22 +408,25 @@ void HttpRequest::handle_post_request() {
   }
 
   if (body_data_.empty()) {
-    response_.generate_response(204, std::vector<char>(), "",
-                                connection_policy_);
+    std::vector<char> no_content;
+    response_.generate_response(204, no_content, "", connection_policy_);
     return;
   }
 
   std::string upload_path = _root + path_;
-  std::ofstream ofs(upload_path.c_str(), std::ios::binary);
-  if (!ofs) {
-    std::cerr << "Failed to open file: " << upload_path << std::endl;
-    response_.generate_error_response(
-        500, "Internal Server Error: Failed to open file", connection_policy_);
-    return;
-  }
+  {
+    SlowOpScope op("write_file");
+    std::ofstream ofs(upload_path.c_str(), std::ios::binary);
+    if (!ofs) {
+      std::cerr << "Failed to open file: " << upload_path << std::endl;
+      response_.generate_error_response(
+          500, "Internal Server Error: Failed to open file", connection_policy_);
+      return;
+    }
 
-  ofs.write(&body_data_[0], body_data_.size());
-  ofs.close();
+    ofs.write(&body_data_[0], body_data_.size());
+    ofs.close();
+  }
 
   std::cout << "File written successfully: " << path_ << std::endl;
   std::string mime_type = MimeTypes::get_mime_type(path_);
@@ -440,8 +468,8 @@ void HttpRequest::handle_delete_request(const std::string path) {
   }
 
   if (status == 0) {
-    response_.generate_response(204, std::vector<char>(), "",
-                                connection_policy_);
+    std::vector<char> no_content;
+    response_.generate_response(204, no_content, "", connection_policy_);
   } else {
     response_.generate_error_response(500, "Internal Server Error",
                                       connection_policy_);
@@ -449,6 +477,7 @@ void HttpRequest::handle_delete_request(const std::string path) {
 }
 
 int HttpRequest::handle_file_delete(const std::string &file_path) {
+  SlowOpScope op("delete_file");
   if (std::remove(file_path.c_str()) == 0) {
     std::cout << "File deleted successfully: " << file_path << std::endl;
     return 0;
@@ -460,6 +489,7 @@ int HttpRequest::handle_file_delete(const std::string &file_path) {
 }
 
 int HttpRequest::handle_directory_delete(const std::string &dir_path) {
+  SlowOpScope op("delete_directory");
   if (!ends_with(dir_path, "/")) {
     response_.generate_error_response(409, "Conflict", connection_policy_);
     return -1;
@@ -524,6 +554,7 @@ int HttpRequest::delete_all_directory_content(const std::string &dir_path) {
 // autoindex
 std::string
 HttpRequest::generate_directory_listing(const std::string &dir_path) {
+  SlowOpScope op("list_directory");
   DIR *dir = opendir(dir_path.c_str());
   if (!dir) {
     return "<html><body><h1>403 Forbidden</h1></body></html>";
@@ -586,22 +617,43 @@ HttpRequest::get_header_values(const std::string &key) const {
   return k_empty_vector;
 }
 
-void HttpRequest::add_header(const std::string &key, const std::string &value) {
+// 前後の空白を除いた [begin, end) を追加する
+static void push_trimmed(std::vector<std::string> &values, const char *begin,
+                         const char *end) {
+  static const char k_space[] = " \t\r\n";
+  while (begin < end && std::strchr(k_space, *begin)) {
+    ++begin;
+  }
+  while (end > begin && std::strchr(k_space, *(end - 1))) {
+    --end;
+  }
+  values.push_back(std::string(begin, end));
+}
+
+// keyは小文字化済み; valueは ',' で区切って値ごとに追加する
+// NOTE: 区切った値を一時的なstringにせず、直接 headers_ に入れる
+void HttpRequest::add_header(const std::string &key, const char *value,
+                             size_t length) {
 
-  if (value.empty()) {
+  if (length == 0) {
     return;
   }
 
-  std::string lower_key = to_lower(key);
+  std::vector<std::string> &values = headers_[key];
+  const char *end = value + length;
 
-  if (lower_key == "date" || key == "set-cookie") {
-    headers_[lower_key].push_back(trim(value));
+  if (key == "date" || key == "set-cookie") {
+    push_trimmed(values, value, end);
     return;
   }
 
-  std::vector<std::string> values = split_csv(value);
-  for (size_t i = 0; i < values.size(); ++i) {
-    headers_[lower_key].push_back(trim(values[i]));
+  const char *pos = value;
+  while (pos < end) {
+    const char *comma =
+        static_cast<const char *>(std::memchr(pos, ',', end - pos));
+    const char *item_end = comma ? comma : end;
+    push_trimmed(values, pos, item_end);
+    pos = comma ? comma + 1 : end;
   }
 }
 
@@ -623,16 +675,34 @@ void HttpRequest::clear() {
   allow_methods_.clear();
   error_page_map_.clear();
 
-  server_config_.clear();
-  location_configs_.clear();
+  server_config_ = &k_empty_config;
+  location_configs_ = &k_empty_locations;
   best_match_config_.clear();
   _root.clear();
   max_body_size_ = k_default_max_body_;
+  routed_at_ = 0;
+  slow_request_ms_ = 0;
 
   connection_policy_ = CP_KEEP_ALIVE;
   status_code_ = 0;
 }
 
+// poolから取り出したClientの接続先を設定する
+void HttpRequest::attach(int fd, const VirtualHostRouter *router) {
+  client_fd_ = fd;
+  virtual_host_router_ = router;
+}
+
+// Clientをpoolに戻す前に、接続に結び付いた状態を手放す
+// cgi_session_ は handle_client_abort() で解放済みかCgiRegistryの管理下
+void HttpRequest::recycle() {
+  clear();
+  release_buffer(body_data_);
+  client_fd_ = -1;
+  virtual_host_router_ = NULL;
+  cgi_session_ = NULL;
+}
+
 HttpRequest &HttpRequest::operator=(const HttpRequest &other) {
   (void)other;
   return *this;
@@ -653,7 +723,7 @@ RedirStatus HttpRequest::handle_redirection() {
   try {
     redir_status_code = str_to_int(return_it->second.at(0));
   } catch (const std::exception &e) {
-    log(LOG_ERROR, e.what());
+    LOG(LOG_ERROR, e.what());
     handle_error(400);
     return REDIR_FAILED;
   }
@@ -667,6 +737,26 @@ RedirStatus HttpRequest::handle_redirection() {
   return REDIR_SUCCESS;
 }
 
+// `stub_status on;` のlocationは、fileの代わりに計測値を返す
+bool HttpRequest::is_stub_status_location() const {
+  ConstConfigIt it = best_match_config_.find("stub_status");
+  return it != best_match_config_.end() && !it->second.empty() &&
+         it->second[0] == "on";
+}
+
+void HttpRequest::handle_stub_status() {
+  if (method_ != "GET") {
+    response_.generate_error_response(405, "Method Not Allowed",
+                                      connection_policy_);
+    return;
+  }
+  std::string text;
+  Metrics::get_instance().render(text);
+  std::vector<char> content(text.begin(), text.end());
+  response_.generate_response(200, content, "text/plain; version=0.0.4",
+                              connection_policy_);
+}
+
 void HttpRequest::handle_error(int status_code) {
   if (error_page_map_.count(status_code)) {
     const std::string &path = error_page_map_[status_code];
@@ -679,26 +769,50 @@ void HttpRequest::handle_error(int status_code) {
 
 void HttpRequest::launch_cgi(const std::string &cgi_path) {
   if (cgi_session_) {
-    log(LOG_WARNING, "cgi_session_ has already created");
+    LOG(LOG_WARNING, "cgi_session_ has already created");
     return;
   }
   try {
-    cgi_session_ = new CgiSession(client_fd_);
+    cgi_session_ = CgiSession::create(client_fd_);
     cgi_session_->handle_cgi_request(*this, cgi_path);
   } catch (const std::exception &e) {
     if (cgi_session_) {
-      delete cgi_session_;
+      CgiSession::release(cgi_session_);
       cgi_session_ = NULL;
     }
     handle_error(500);
   }
 }
 
+void HttpRequest::launch_fastcgi() {
+  if (cgi_session_) {
+    LOG(LOG_WARNING, "cgi_session_ has already created");
+    return;
+  }
+  const std::string &address = best_match_config_["fastcgi_pass"][0];
+  std::string script_path = _root + path_.substr(0, path_.find('?'));
+  try {
+    cgi_session_ = CgiSession::create(client_fd_);
+    cgi_session_->handle_fastcgi_request(*this, address, script_path);
+  } catch (const std::exception &e) {
+    LOG(LOG_ERROR, e.what());
+    if (cgi_session_) {
+      CgiSession::release(cgi_session_);
+      cgi_session_ = NULL;
+    }
+    handle_error(502);
+  }
+}
+
 bool HttpRequest::has_cgi_session() const { return cgi_session_ != NULL; }
 
 CgiSession *HttpRequest::get_cgi_session() const { return cgi_session_; }
 
 void HttpRequest::clear_cgi_session() {
-  delete cgi_session_;
+  CgiSession::release(cgi_session_);
   cgi_session_ = NULL;
 }
+
+// 解放はCgiRegistryに任せた (mark_client_dead済み) ので、参照だけ外す
+// 残しておくと、poolで別のrequestに渡ったsessionを後で触ってしまう
+void HttpRequest::detach_cgi_session() { cgi_session_ = NULL; }
@@ -1,5 +1,6 @@
 #include "HttpRequestParser.hpp"
 #include "Logger.hpp"
+#include "ObjectPool.hpp"
 #include "Utils.hpp"
 #include <algorithm>
 #include <set>
@@ -17,8 +18,9 @@ static const char *methods_arr[] = {"GET",    "HEAD",    "POST",    "PUT",
 static const std::set<std::string> supported_methods(
     methods_arr, methods_arr + sizeof(methods_arr) / sizeof(methods_arr[0]));
 
-HttpRequestParser::HttpRequestParser(HttpRequest &http_request)
-    : request(http_request), parse_state(PARSE_HEADER) {}
+HttpRequestParser::HttpRequestParser(HttpRequest &http_request,
+                                     RequestArena &request_arena)
+    : request(http_request), arena(request_arena), parse_state(PARSE_HEADER) {}
 
 HttpRequestParser::~HttpRequestParser() {}
 
@@ -42,9 +44,15 @@ bool HttpRequestParser::parse() {
 void HttpRequestParser::clear() {
   LOG_DEBUG_FUNC();
   request.clear();
+  arena.reset(); // requestの解析に使った一時領域をまとめて解放
   parse_state = PARSE_HEADER;
 }
 
+void HttpRequestParser::recycle() {
+  clear();
+  release_buffer(recv_buffer);
+}
+
 void HttpRequestParser::append_data(const char *data, size_t length) {
   LOG_DEBUG_FUNC();
   recv_buffer.insert(recv_buffer.end(), data, data + length);
@@ -63,30 +71,30 @@ void HttpRequestParser::parse_header() {
     return;
   }
 
+  // header部はこのrequestの間だけ使うので、arenaに移して行ごとに切り出す
   size_t header_end = std::distance(recv_buffer.begin(), it);
-  std::string header_text(recv_buffer.begin(),
-                          recv_buffer.begin() + header_end);
-
-  std::istringstream iss(header_text);
-  std::string line;
+  const char *pos = arena.copy(&recv_buffer[0], header_end);
+  const char *end = pos + header_end;
+  const char *line;
+  size_t length;
 
   recv_buffer.erase(recv_buffer.begin(), it + 4); // "\r\n\r\n"まで削除
-  if (!std::getline(iss, line) || !parse_request_line(line)) {
-    log(LOG_DEBUG, "Failed to parse request line");
+  if (!next_line(pos, end, line, length) || !parse_request_line(line, length)) {
+    LOG(LOG_DEBUG, "Failed to parse request line");
     set_framing_error(400);
     return;
   }
   validate_request_content();
 
-  while (std::getline(iss, line) && !line.empty()) {
-    if (!parse_header_line(line)) {
-      log(LOG_DEBUG, "Failed to parse header line: " + line);
+  while (next_line(pos, end, line, length) && length > 0) {
+    if (!parse_header_line(line, length)) {
+      LOG(LOG_DEBUG, "Failed to parse header line: " + std::string(line, length));
       set_framing_error(400);
       return;
     }
   }
   if (!check_framing_error()) {
-    log(LOG_DEBUG, "Framing error detected by checking");
+    LOG(LOG_DEBUG, "Framing error detected by checking");
     set_framing_error(400);
     return;
   }
@@ -139,7 +147,7 @@ void HttpRequestParser::parse_chunked_body() {
     try {
       chunk_size = parse_hex(size_str);
     } catch (const std::exception &e) {
-      log(LOG_ERROR, "Failed to parse chunk size: " + size_str);
+      LOG(LOG_ERROR, "Failed to parse chunk size: " + size_str);
       set_framing_error(400);
       return;
     }
@@ -170,71 +178,109 @@ void HttpRequestParser::parse_chunked_body() {
   parse_state = PARSE_DONE;
 }
 
-bool HttpRequestParser::parse_request_line(std::string &line) {
-  LOG_DEBUG_FUNC();
-
-  if (line.empty() || line.size() > k_max_request_line ||
-      std::isspace(line[0])) {
+// [pos, end) から '\n' までを1行として取り出す ('\n' は含めない)
+bool HttpRequestParser::next_line(const char *&pos, const char *end,
+                                  const char *&line, size_t &length) {
+  if (pos >= end) {
     return false;
   }
+  const char *newline =
+      static_cast<const char *>(std::memchr(pos, '\n', end - pos));
+  line = pos;
+  length = (newline ? newline : end) - pos;
+  pos = newline ? newline + 1 : end;
+  return true;
+}
 
-  std::istringstream request_iss(line);
-  if (!(request_iss >> request.method_ >> request.path_ >> request.version_)) {
-    log(LOG_ERROR, "Failed to parse request line: " + line);
+// 空白区切りの次の要素を [token, token + length) に入れる; なければfalse
+static bool next_token(const char *&pos, const char *end, const char *&token,
+                       size_t &length) {
+  while (pos < end && std::isspace(static_cast<unsigned char>(*pos))) {
+    ++pos;
+  }
+  if (pos == end) {
     return false;
   }
+  token = pos;
+  while (pos < end && !std::isspace(static_cast<unsigned char>(*pos))) {
+    ++pos;
+  }
+  length = pos - token;
+  return true;
+}
+
+bool HttpRequestParser::parse_request_line(const char *line, size_t length) {
+  LOG_DEBUG_FUNC();
 
-  std::string ext;
-  if (request_iss >> ext) {
-    log(LOG_DEBUG, "Extra characters (" + ext + ") in request line");
+  if (length == 0 || length > k_max_request_line ||
+      std::isspace(static_cast<unsigned char>(line[0]))) {
     return false;
   }
 
-  if (request.method_.empty() || request.path_.empty() ||
-      request.version_.empty()) {
-    log(LOG_DEBUG, "Failed to parse request line (empty value)");
+  // method, target, version の3つだけで、余分な要素はerror
+  const char *pos = line;
+  const char *end = line + length;
+  const char *tokens[3];
+  size_t lengths[3];
+  for (size_t i = 0; i < 3; ++i) {
+    if (!next_token(pos, end, tokens[i], lengths[i])) {
+      LOG(LOG_ERROR, "Failed to parse request line: " + std::string(line, length));
+      return false;
+    }
+  }
+  const char *extra;
+  size_t extra_length;
+  if (next_token(pos, end, extra, extra_length)) {
+    LOG(LOG_DEBUG, "Extra characters (" + std::string(extra, extra_length) +
+                       ") in request line");
     return false;
   }
+  request.method_.assign(tokens[0], lengths[0]);
+  request.path_.assign(tokens[1], lengths[1]);
+  request.version_.assign(tokens[2], lengths[2]);
 
   for (size_t i = 0; i < request.path_.size(); ++i) {
     char c = request.path_.at(i);
     if (!std::isdigit(c) && !std::isalpha(c) &&
         !std::strchr(unreserved_chars, c) && !std::strchr(reserved_chars, c)) {
-      log(LOG_DEBUG, std::string("Invalid character in target: '") + c + "'");
+      LOG(LOG_DEBUG, std::string("Invalid character in target: '") + c + "'");
       return false;
     }
   }
 
-  log(LOG_DEBUG, "Parsed Request - Method: " + request.method_ + ", Path: " +
+  LOG(LOG_DEBUG, "Parsed Request - Method: " + request.method_ + ", Path: " +
                      request.path_ + ", Version: " + request.version_);
   return true;
 }
 
-bool HttpRequestParser::parse_header_line(std::string &line) {
+bool HttpRequestParser::parse_header_line(const char *line, size_t length) {
 
-  if (line.size() > k_max_request_line || std::isspace(line[0])) {
-    log(LOG_ERROR, "Invalid header field: " + line);
+  if (length > k_max_request_line ||
+      std::isspace(static_cast<unsigned char>(line[0]))) {
+    LOG(LOG_ERROR, "Invalid header field: " + std::string(line, length));
     return false;
   }
 
-  size_t pos = line.find(":");
-  if (pos == std::string::npos || pos == 0) {
-    log(LOG_ERROR, "Failed to parse header line: " + line);
+  const char *colon = static_cast<const char *>(std::memchr(line, ':', length));
+  if (colon == NULL || colon == line) {
+    LOG(LOG_ERROR, "Failed to parse header line: " + std::string(line, length));
     return false;
   }
 
-  std::string key = line.substr(0, pos);    // keyはtrimしない
-  std::string value = line.substr(pos + 1); // add_header() でtrim
-
+  // keyはtrimしない; headerのmapに入れるstringへ直接小文字で書く
+  std::string key(line, colon - line);
   for (size_t i = 0; i < key.size(); ++i) {
     if (!is_valid_field_name_char(key[i])) {
-      log(LOG_ERROR, "Invalid character in field-name: " + line);
+      LOG(LOG_ERROR,
+          "Invalid character in field-name: " + std::string(line, length));
       return false;
     }
+    key[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(key[i])));
   }
-  request.add_header(key, value);
+  // valueは add_header() で区切りとtrimを行う
+  request.add_header(key, colon + 1, line + length - (colon + 1));
 
-  log(LOG_DEBUG, "Parsed - Key: " + key + ": " + request.get_header_value(key));
+  LOG(LOG_DEBUG, "Parsed - Key: " + key + ": " + request.get_header_value(key));
   return true;
 }
 
@@ -246,21 +292,21 @@ void HttpRequestParser::validate_request_content() {
   }
 
   if (request.path_.size() > k_max_request_target) {
-    log(LOG_DEBUG, "Request-target is too long");
+    LOG(LOG_DEBUG, "Request-target is too long");
     request.set_status_code(414);
     return;
   }
 
   // method 不正
   if (supported_methods.find(request.method_) == supported_methods.end()) {
-    log(LOG_DEBUG, "Unsupported HTTP method: " + request.method_);
+    LOG(LOG_DEBUG, "Unsupported HTTP method: " + request.method_);
     request.set_status_code(501);
     return;
   }
 
   // HTTP version 不正
   if (request.version_ != "HTTP/1.1") {
-    log(LOG_ERROR, "Unsupported HTTP version: " + request.version_);
+    LOG(LOG_ERROR, "Unsupported HTTP version: " + request.version_);
     request.set_status_code(505);
   }
 }
@@ -272,7 +318,7 @@ bool HttpRequestParser::check_framing_error() {
   if (!request.is_in_headers("Host") ||
       request.get_header_value("Host").empty() ||
       request.get_header_values("Host").size() > 1) {
-    log(LOG_ERROR, "Invalid Host header");
+    LOG(LOG_ERROR, "Invalid Host header");
     return false;
   }
 
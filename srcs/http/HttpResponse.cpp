@@ -11,10 +11,14 @@
 /* ************************************************************************** */
 
 #include "HttpResponse.hpp"
+#include "HeaderWriter.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "ResponseTemplates.hpp"
 #include "Utils.hpp"
 
-HttpResponse::HttpResponse() {}
+HttpResponse::HttpResponse()
+    : queued_bytes_(0), last_status_(0), total_bytes_(0) {}
 
 HttpResponse::~HttpResponse() {}
 
@@ -25,228 +29,265 @@ ResponseEntry *HttpResponse::get_front_response() {
 
 bool HttpResponse::has_response() const { return (!response_queue_.empty()); }
 
-void HttpResponse::push_back_response(ConnectionPolicy conn,
-                                      const std::vector<char> &buf) {
+size_t HttpResponse::get_queued_bytes() const { return queued_bytes_; }
+
+void HttpResponse::record_status(int status_code) {
+  Metrics::get_instance().count_response(status_code);
+  last_status_ = status_code;
+}
+
+// ResponseTemplates で組み立て済みの応答を、そのまま1つのentryにする
+void HttpResponse::push_back_rendered(ConnectionPolicy conn,
+                                      std::vector<char> &data) {
+  append_segment(push_back_entry(conn), data);
+}
+
+void HttpResponse::pop_front_response() {
   LOG_DEBUG_FUNC();
-  if (buf.empty()) {
-    return;
-  }
-  struct ResponseEntry entry;
+  queued_bytes_ -= response_queue_.front().length;
+  response_queue_.pop_front();
+}
+
+void HttpResponse::clear() {
+  response_queue_.clear();
+  queued_bytes_ = 0;
+}
+
+// 空のentryをqueueに積んでから中身を入れる (entryごとのコピーを避ける)
+ResponseEntry &HttpResponse::push_back_entry(ConnectionPolicy conn) {
+  response_queue_.push_back(ResponseEntry());
+  ResponseEntry &entry = response_queue_.back();
   entry.conn = conn;
-  entry.buffer = buf;
+  entry.length = 0;
   entry.offset = 0;
-  response_queue_.push(entry);
+  return entry;
 }
 
-void HttpResponse::push_back_response(ConnectionPolicy conn,
-                                      std::ostringstream &oss) {
-  std::string str = oss.str();
-  if (str.empty()) {
+void HttpResponse::append_segment(ResponseEntry &entry,
+                                  std::vector<char> &data) {
+  if (data.empty()) {
     return;
   }
-  struct ResponseEntry entry;
-  entry.conn = conn;
-  entry.buffer = std::vector<char>(str.begin(), str.end());
-  entry.offset = 0;
-  response_queue_.push(entry);
+  entry.segments.push_back(std::vector<char>());
+  entry.segments.back().swap(data);
+  entry.length += entry.segments.back().size();
+  queued_bytes_ += entry.segments.back().size();
+  total_bytes_ += entry.segments.back().size();
 }
 
-void HttpResponse::pop_front_response() {
-  LOG_DEBUG_FUNC();
-  response_queue_.pop();
+void HttpResponse::append_segment(ResponseEntry &entry,
+                                  const std::string &data) {
+  std::vector<char> segment(data.begin(), data.end());
+  append_segment(entry, segment);
+}
+
+// 先頭から順に、未送信部分をiovecに並べる; 使ったiovecの数を返す
+// 接続を閉じるentryの後ろは送らない (送信後の処理はentryごとに行う)
+int HttpResponse::fill_iovec(struct iovec *iov, int max_iov) const {
+  int count = 0;
+
+  for (std::deque<ResponseEntry>::const_iterator it = response_queue_.begin();
+       it != response_queue_.end() && count < max_iov; ++it) {
+    count += fill_entry_iovec(*it, iov + count, max_iov - count);
+    if (it->conn != CP_KEEP_ALIVE) {
+      break;
+    }
+  }
+  return count;
+}
+
+int HttpResponse::fill_entry_iovec(const ResponseEntry &entry,
+                                   struct iovec *iov, int max_iov) {
+  size_t skip = entry.offset;
+  int count = 0;
+
+  for (size_t i = 0; i < entry.segments.size() && count < max_iov; ++i) {
+    const std::vector<char> &segment = entry.segments[i];
+    if (skip >= segment.size()) {
+      skip -= segment.size();
+      continue;
+    }
+    iov[count].iov_base = const_cast<char *>(&segment[skip]);
+    iov[count].iov_len = segment.size() - skip;
+    skip = 0;
+    ++count;
+  }
+  return count;
 }
 
 void HttpResponse::generate_response(int status_code,
-                                     const std::vector<char> &content,
+                                     std::vector<char> &content,
                                      const std::string &content_type,
                                      ConnectionPolicy conn) {
   LOG_DEBUG_FUNC();
+  record_status(status_code);
 
-  std::ostringstream oss;
-  oss << "HTTP/1.1 " << status_code << " OK\r\n";
+  std::vector<char> head;
+  HeaderWriter writer(head);
+  writer.status_line(status_code);
   if (status_code != 204) {
-    oss << "Content-Length: " << content.size() << "\r\n";
-    oss << "Content-Type: " << content_type << "\r\n";
+    writer.header("Content-Length", content.size());
+    writer.header("Content-Type", content_type);
   }
-  oss << "Date: " << get_date() << "\r\n";
-  oss << "Connection: " << to_connection_value(conn) << "\r\n\r\n";
-  std::string header = oss.str();
+  writer.date_header();
+  writer.connection_header(conn);
+  writer.end();
 
-  std::vector<char> response;
-  response.insert(response.end(), header.begin(), header.end());
-  response.insert(response.end(), content.begin(), content.end());
-
-  push_back_response(conn, response);
+  ResponseEntry &entry = push_back_entry(conn);
+  append_segment(entry, head);
+  append_segment(entry, content);
 }
 
 void HttpResponse::generate_response(
     int status_code,
     const std::vector<std::pair<std::string, std::string> > &headers,
-    const std::vector<char> &body, ConnectionPolicy conn) {
+    std::vector<char> &body, ConnectionPolicy conn) {
   LOG_DEBUG_FUNC();
+  record_status(status_code);
 
-  std::ostringstream oss;
-  oss << "HTTP/1.1 " << status_code << " " << get_status_message(status_code)
-      << "\r\n";
-  for (size_t i = 0; i < headers.size(); ++i) {
-    oss << headers[i].first << ": " << headers[i].second << "\r\n";
-  }
-  oss << "Date: " << get_date() << "\r\n";
-  oss << "Connection: " << to_connection_value(conn) << "\r\n\r\n";
+  std::vector<char> head;
+  write_header(head, status_code, headers, conn);
 
-  std::string header_str = oss.str();
-  std::vector<char> full_response(header_str.begin(), header_str.end());
-  full_response.insert(full_response.end(), body.begin(), body.end());
-
-  push_back_response(conn, full_response);
+  ResponseEntry &entry = push_back_entry(conn);
+  append_segment(entry, head);
+  append_segment(entry, body);
 }
 
 void HttpResponse::generate_created_response(const std::string &location,
-                                             const std::vector<char> &content,
+                                             std::vector<char> &content,
                                              const std::string &content_type,
                                              ConnectionPolicy conn) {
   LOG_DEBUG_FUNC();
+  record_status(201);
 
-  std::ostringstream oss;
-  oss << "HTTP/1.1 201 Created\r\n";
-  oss << "Content-Length: " << content.size() << "\r\n";
+  std::vector<char> head;
+  HeaderWriter writer(head);
+  writer.status_line(201);
+  writer.header("Content-Length", content.size());
   if (!content.empty()) {
-    oss << "Content-Type: " << content_type << "\r\n";
+    writer.header("Content-Type", content_type);
   }
-  oss << "Date: " << get_date() << "\r\n";
-  oss << "Location: " << location << "\r\n";
-  oss << "Connection: " << to_connection_value(conn) << "\r\n\r\n";
-  std::string header = oss.str();
-
-  std::vector<char> response;
-  response.insert(response.end(), header.begin(), header.end());
-  response.insert(response.end(), content.begin(), content.end());
-
-  push_back_response(conn, response);
+  writer.date_header();
+  writer.header("Location", location);
+  writer.connection_header(conn);
+  writer.end();
+
+  ResponseEntry &entry = push_back_entry(conn);
+  append_segment(entry, head);
+  append_segment(entry, content);
 }
 
-void HttpResponse::generate_chunk_response_header(
+void HttpResponse::generate_response_header(
     int status_code,
     const std::vector<std::pair<std::string, std::string> > &headers,
     ConnectionPolicy conn_policy) {
   LOG_DEBUG_FUNC();
+  record_status(status_code);
 
-  std::ostringstream oss;
-  oss << "HTTP/1.1 " << status_code << " " << get_status_message(status_code)
-      << "\r\n";
-  for (size_t i = 0; i < headers.size(); ++i) {
-    oss << headers[i].first << ": " << headers[i].second << "\r\n";
-  }
-  oss << "Date: " << get_date() << "\r\n";
-  oss << "Connection: " << to_connection_value(conn_policy) << "\r\n\r\n";
+  std::vector<char> head;
+  write_header(head, status_code, headers, conn_policy);
 
-  std::string header_str = oss.str();
-  std::vector<char> header_vec(header_str.begin(), header_str.end());
   // NOTE: header 送信時点では、接続の終了判断はしない（必ず keep-alive にする）
-  push_back_response(CP_KEEP_ALIVE, header_vec);
+  append_segment(push_back_entry(CP_KEEP_ALIVE), head);
 }
 
-void HttpResponse::generate_chunk_response_body(const std::vector<char> &data) {
+void HttpResponse::generate_response_body(std::vector<char> &body,
+                                          ConnectionPolicy conn_policy) {
+  LOG_DEBUG_FUNC();
+  if (body.empty()) {
+    return;
+  }
+  append_segment(push_back_entry(conn_policy), body);
+}
+
+// 送信データを持たず、送信順が来たら接続の終了処理だけを行うentry
+void HttpResponse::generate_connection_close(ConnectionPolicy conn_policy) {
+  LOG_DEBUG_FUNC();
+  push_back_entry(conn_policy);
+}
+
+void HttpResponse::generate_chunk_response_header(
+    int status_code,
+    const std::vector<std::pair<std::string, std::string> > &headers,
+    ConnectionPolicy conn_policy) {
+  generate_response_header(status_code, headers, conn_policy);
+}
+
+// chunkの枠 (size行とCRLF) とdataを別segmentにし、dataはコピーしない
+void HttpResponse::generate_chunk_response_body(std::vector<char> &data) {
   LOG_DEBUG_FUNC();
   if (data.empty()) {
     return;
   }
   static const char kCRLF[] = "\r\n";
-  std::ostringstream oss;
-  std::vector<char> chunk;
+  std::vector<char> size_line;
+  HeaderWriter writer(size_line);
 
-  oss << std::hex << data.size() << kCRLF;
-  std::string size_line = oss.str();
-
-  chunk.insert(chunk.end(), size_line.begin(), size_line.end());
-  chunk.insert(chunk.end(), data.begin(), data.end());
-  chunk.insert(chunk.end(), kCRLF, kCRLF + 2);
+  writer.append_hex(data.size());
+  writer.append(kCRLF, 2);
+  writer.flush();
   // NOTE: last chunk 未送信時点では、接続の終了判断はしない（必ず keep-alive）
-  push_back_response(CP_KEEP_ALIVE, chunk);
+  ResponseEntry &entry = push_back_entry(CP_KEEP_ALIVE);
+  append_segment(entry, size_line);
+  append_segment(entry, data);
+  append_segment(entry, std::string(kCRLF));
 }
 
 void HttpResponse::generate_chunk_response_last(ConnectionPolicy conn_policy) {
   LOG_DEBUG_FUNC();
   static const char k_chunk_end_marker[] = "0\r\n\r\n";
-  std::vector<char> chunk;
 
-  chunk.insert(chunk.end(), k_chunk_end_marker, k_chunk_end_marker + 5);
-  push_back_response(conn_policy, chunk);
+  append_segment(push_back_entry(conn_policy),
+                 std::string(k_chunk_end_marker));
 }
 
+// config読み込み時に作ったtemplateがなければ、その場でfileを読んで組み立てる
 void HttpResponse::generate_custom_error_page(int status_code,
                                               const std::string &error_page,
                                               std::string _root,
                                               ConnectionPolicy conn) {
   LOG_DEBUG_FUNC();
+  record_status(status_code);
+  std::vector<char> rendered;
+  if (ResponseTemplates::get_instance().render_custom_error(
+          status_code, _root + error_page, conn, rendered)) {
+    push_back_rendered(conn, rendered);
+    return;
+  }
+  std::string content_type = "text/html";
+  std::string file_content;
   try {
-    std::string file_content = read_file(_root + error_page);
-
-    std::ostringstream response;
-    response << "HTTP/1.1 " << status_code << " ";
-    if (status_code == 403) {
-      response << "Forbidden";
-    } else if (status_code == 404) {
-      response << "Not Found";
-    } else if (status_code == 405) {
-      response << "Method Not Allowed";
-    }
-    response << "\r\n";
-    response << "Content-Length: " << file_content.size() << "\r\n";
-    response << "Content-Type: text/html\r\n";
-    response << "Date: " << get_date() << "\r\n";
-    response << "Connection: " << to_connection_value(conn) << "\r\n\r\n";
-    response << file_content;
-
-    push_back_response(conn, response);
-
+    file_content = read_file(_root + error_page);
   } catch (const std::exception &e) {
-    std::ostringstream fallback;
-    fallback << "HTTP/1.1 " << status_code << " ";
-    if (status_code == 404) {
-      fallback << "Not Found";
-    } else if (status_code == 405) {
-      fallback << "Method Not Allowed";
-    }
-    fallback << "\r\n";
-    fallback << "Content-Length: 9\r\n";
-    fallback << "Content-Type: text/plain\r\n";
-    fallback << "Date: " << get_date() << "\r\n";
-    fallback << "Connection: " << to_connection_value(conn) << "\r\n\r\n";
-    fallback << "Not Found";
-
-    push_back_response(conn, fallback);
+    content_type = "text/plain";
+    file_content = "Not Found";
   }
+  push_back_simple(status_code, content_type, file_content, conn);
 }
 
 void HttpResponse::generate_error_response(int status_code,
                                            const std::string &message,
                                            ConnectionPolicy conn) {
   LOG_DEBUG_FUNC();
-  std::ostringstream response;
-  response << "HTTP/1.1 " << status_code << " " << message << "\r\n";
-  response << "Content-Length: " << message.size() << "\r\n";
-  response << "Content-Type: text/plain\r\n";
-  response << "Date: " << get_date() << "\r\n";
-  response << "Connection: " << to_connection_value(conn) << "\r\n\r\n";
-  response << message;
-
-  push_back_response(conn, response);
+  record_status(status_code);
+  std::vector<char> rendered;
+  ResponseTemplates::get_instance().render_error(status_code, message, conn,
+                                                 rendered);
+  push_back_rendered(conn, rendered);
 }
 
 void HttpResponse::generate_error_response(int status_code,
                                            ConnectionPolicy conn) {
   LOG_DEBUG_FUNC();
-  std::ostringstream response;
-  const std::string &message = get_status_message(status_code);
-  response << "HTTP/1.1 " << status_code << " " << message << "\r\n";
-  response << "Content-Length: " << message.size() << "\r\n";
-  response << "Content-Type: text/plain\r\n";
-  response << "Date: " << get_date() << "\r\n";
-  response << "Connection: " << to_connection_value(conn) << "\r\n\r\n";
-  response << message;
-
-  push_back_response(conn, response);
+  record_status(status_code);
+  std::vector<char> rendered;
+  if (ResponseTemplates::get_instance().render_error(status_code, conn,
+                                                     rendered)) {
+    push_back_rendered(conn, rendered);
+    return;
+  }
+  push_back_simple(status_code, "text/plain", get_status_message(status_code),
+                   conn);
 }
 
 void HttpResponse::generate_redirect(int status_code,
@@ -254,87 +295,105 @@ void HttpResponse::generate_redirect(int status_code,
                                      ConnectionPolicy conn) {
 
   LOG_DEBUG_FUNC();
-  std::ostringstream response;
-  response << "HTTP/1.1 " << status_code << " ";
-  response << HttpResponse::get_status_message(status_code) << "\r\n";
-  response << "Location: " << new_location << "\r\n";
-  response << "Content-Length: 0\r\n";
-  response << "Date: " << get_date() << "\r\n";
-  response << "Connection: " << to_connection_value(conn) << "\r\n\r\n";
-  push_back_response(conn, response);
+  record_status(status_code);
+  std::vector<char> rendered;
+  if (ResponseTemplates::get_instance().render_redirect(
+          status_code, new_location, conn, rendered)) {
+    push_back_rendered(conn, rendered);
+    return;
+  }
+  HeaderWriter writer(rendered);
+  writer.status_line(status_code);
+  writer.header("Location", new_location);
+  writer.header("Content-Length", static_cast<size_t>(0));
+  writer.date_header();
+  writer.connection_header(conn);
+  writer.end();
+  push_back_rendered(conn, rendered);
 }
 
 void HttpResponse::generate_timeout_response() {
   LOG_DEBUG_FUNC();
-
-  std::ostringstream content;
-  content << "<html>\n"
-          << "  <head>\n"
-          << "    <title>408 Request Timeout</title>\n"
-          << "  </head>\n"
-          << "  <body>\n"
-          << "    <h1>408 Request Timeout</h1>\n"
-          << "    <p>Failed to process request in time. Please try again.</p>\n"
-          << "  </body>\n"
-          << "</html>";
-
-  std::string content_str = content.str();
-
-  std::ostringstream response;
-  response << "HTTP/1.1 408 Request Timeout\r\n";
-  response << "Content-Type: text/html\r\n";
-  response << "Content-Length: " << content_str.size() << "\r\n";
-  response << "Date: " << get_date() << "\r\n";
-  response << "Connection: close\r\n\r\n";
-  response << content_str;
-
-  push_back_response(CP_MUST_CLOSE, response);
+  record_status(408);
+  std::vector<char> rendered;
+  ResponseTemplates::get_instance().render_timeout(rendered);
+  push_back_rendered(CP_MUST_CLOSE, rendered);
 }
 
-const char *HttpResponse::get_status_message(int status_code) {
-  switch (status_code) {
-  case 200:
-    return "OK";
-  case 301:
-    return "Moved Permanently";
-  case 302:
-    return "Found";
-  case 303:
-    return "See Other";
-  case 307:
-    return "Temporary Redirect";
-  case 308:
-    return "Permanent Redirect";
-  case 400:
-    return "Bad Request";
-  case 403:
-    return "Forbidden";
-  case 404:
-    return "Not Found";
-  case 405:
-    return "Method Not Allowed";
-  case 408:
-    return "Request Timeout";
-  case 413:
-    return "Payload Too Large";
-  case 414:
-    return "URI Too Long";
-  case 431:
-    return "Request Header Fields Too Large";
-  case 500:
-    return "Internal Server Error";
-  case 501:
-    return "Not Implemented";
-  case 505:
-    return "HTTP Version Not Supported";
-  default:
-    logfd(LOG_ERROR, "Undefined status code detected: ", status_code);
-    return "Status Not Defined";
+// status行, 受け取ったheader, Date, Connection の順に書く
+void HttpResponse::write_header(
+    std::vector<char> &out, int status_code,
+    const std::vector<std::pair<std::string, std::string> > &headers,
+    ConnectionPolicy conn) {
+  HeaderWriter writer(out);
+  writer.status_line(status_code);
+  for (size_t i = 0; i < headers.size(); ++i) {
+    writer.header(headers[i].first, headers[i].second);
   }
+  writer.date_header();
+  writer.connection_header(conn);
+  writer.end();
+}
+
+// Content-Length と Content-Type だけを持つ小さな応答を1つのsegmentで積む
+void HttpResponse::push_back_simple(int status_code,
+                                    const std::string &content_type,
+                                    const std::string &body,
+                                    ConnectionPolicy conn) {
+  std::vector<char> data;
+  data.reserve(body.size() + 256);
+  HeaderWriter writer(data);
+  writer.status_line(status_code);
+  writer.header("Content-Length", body.size());
+  writer.header("Content-Type", content_type);
+  writer.date_header();
+  writer.connection_header(conn);
+  writer.end();
+  writer.append(body);
+  writer.flush();
+  push_back_rendered(conn, data);
 }
 
-const char *HttpResponse::to_connection_value(ConnectionPolicy conn) const {
-  return conn == CP_KEEP_ALIVE ? "keep-alive" : "close";
+struct StatusMessage {
+  int code;
+  const char *message;
+};
+
+static const StatusMessage k_status_messages[] = {
+    {200, "OK"},
+    {201, "Created"},
+    {204, "No Content"},
+    {301, "Moved Permanently"},
+    {302, "Found"},
+    {303, "See Other"},
+    {304, "Not Modified"},
+    {307, "Temporary Redirect"},
+    {308, "Permanent Redirect"},
+    {400, "Bad Request"},
+    {403, "Forbidden"},
+    {404, "Not Found"},
+    {405, "Method Not Allowed"},
+    {408, "Request Timeout"},
+    {409, "Conflict"},
+    {413, "Payload Too Large"},
+    {414, "URI Too Long"},
+    {431, "Request Header Fields Too Large"},
+    {500, "Internal Server Error"},
+    {501, "Not Implemented"},
+    {502, "Bad Gateway"},
+    {504, "Gateway Timeout"},
+    {505, "HTTP Version Not Supported"},
+};
+
+const char *HttpResponse::get_status_message(int status_code) {
+  const size_t count = sizeof(k_status_messages) / sizeof(k_status_messages[0]);
+  for (size_t i = 0; i < count; ++i) {
+    if (k_status_messages[i].code == status_code) {
+      return k_status_messages[i].message;
+    }
+  }
+  LOG_FD(LOG_ERROR, "Undefined status code detected: ", status_code);
+  return "Status Not Defined";
 }
 
 HttpResponse &HttpResponse::operator=(const HttpResponse &other) {
@@ -1,18 +1,48 @@
 #include "HttpTransaction.hpp"
+#include "AccessLog.hpp"
 #include "CgiSession.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include <sstream>
 
 // NOTE: HttpTransaction は HTTP処理状態を制御
 // ソケット（fd）とコネクションの生死は clientの管轄
 // CGIの応答遅延など → HttpTransaction あるいは CgiSession に責務を持たせる
 HttpTransaction::HttpTransaction(int fd, const VirtualHostRouter *router)
-    : client_fd_(fd), response_(), request_(fd, router, response_),
-      parser_(request_) {}
+    : client_fd_(fd), response_(), request_(fd, router, response_), arena_(),
+      parser_(request_, arena_), times_(), flush_started_(0),
+      bytes_at_parsed_(0), request_line_() {
+  if (fd != -1) {
+    times_.accepted = Metrics::now_usec();
+  }
+}
 
 HttpTransaction::~HttpTransaction() {}
 
+void HttpTransaction::attach(int fd, const VirtualHostRouter *router) {
+  client_fd_ = fd;
+  request_.attach(fd, router);
+  times_.accepted = Metrics::now_usec();
+}
+
+// CGIの後始末はdestructorと同じ; 各bufferは容量を残して空にする
+void HttpTransaction::recycle() {
+  handle_client_abort();
+  parser_.recycle();
+  request_.recycle();
+  response_.clear();
+  client_fd_ = -1;
+  times_ = RequestTimes();
+  flush_started_ = 0;
+  request_line_.clear();
+}
+
 // parserのbufferにraw dataを蓄積
 void HttpTransaction::append_data(const char *raw, size_t length) {
   LOG_DEBUG_FUNC();
+  if (times_.received == 0) {
+    times_.received = Metrics::now_usec();
+  }
   parser_.append_data(raw, length);
 }
 
@@ -25,24 +55,125 @@ void HttpTransaction::process_data() {
   }
   bool keep_alive = true;
   while (keep_alive && parser_.parse()) {
+    unsigned long long now = Metrics::now_usec();
+    if (times_.received == 0) {
+      times_.received = now; // pipelineされた後続のrequest
+    }
+    times_.parsed = now;
+    bytes_at_parsed_ = response_.get_total_bytes();
+    request_line_.assign(request_.get_method()).append(" ").append(
+        request_.get_path()); // 容量を再利用する
     request_.handle_http_request(); // responseを生成し、response queueに積む
     if (request_.has_cgi_session()) {
       process_cgi_session();
       return;
     }
     keep_alive = request_.get_connection_policy() == CP_KEEP_ALIVE;
+    times_.responded = Metrics::now_usec();
+    finish_request(0); // requestの内容を使うので clear() より前に
     parser_.clear();
   }
 }
 
+// 区間ごとの所要時間と、requestの受信開始から応答を積み終えるまでの時間を記録する
+void HttpTransaction::finish_request(size_t relayed_bytes) {
+  if (times_.received == 0) {
+    return;
+  }
+  Metrics &metrics = Metrics::get_instance();
+  unsigned long long now = Metrics::now_usec();
+  unsigned long long routed = request_.get_routed_at();
+
+  if (times_.accepted != 0) {
+    metrics.observe_phase(Metrics::REQUEST_WAIT,
+                          times_.received - times_.accepted);
+  }
+  if (times_.parsed != 0) {
+    metrics.observe_phase(Metrics::REQUEST_PARSE,
+                          times_.parsed - times_.received);
+  }
+  if (routed != 0) {
+    metrics.observe_phase(Metrics::REQUEST_ROUTE, routed - times_.parsed);
+    if (times_.responded != 0) {
+      metrics.observe_phase(Metrics::REQUEST_HANDLE,
+                            times_.responded - routed);
+    }
+  }
+  metrics.observe_request(now - times_.received);
+  log_slow_request(now, routed);
+  if (AccessLog::get_instance().is_enabled()) {
+    write_access_log(now, relayed_bytes);
+  }
+
+  if (flush_started_ == 0 && response_.has_response()) {
+    flush_started_ = now;
+  }
+  times_ = RequestTimes(); // acceptからの待ち時間は接続の最初のrequestだけ
+}
+
+// 応答を積む前にclientが切断していれば、nginxと同じく 499 とする
+void HttpTransaction::write_access_log(unsigned long long now,
+                                       size_t relayed_bytes) {
+  AccessLogRecord record;
+  record.request = &request_;
+  record.client_fd = client_fd_;
+  record.bytes_sent =
+      response_.get_total_bytes() - bytes_at_parsed_ + relayed_bytes;
+  record.status = record.bytes_sent == 0 ? 499 : response_.get_last_status();
+  record.request_usec = now - times_.received;
+  AccessLog::get_instance().write(record);
+}
+
+static void append_phase_ms(std::ostringstream &oss, const char *name,
+                            unsigned long long from, unsigned long long to) {
+  oss << " " << name << "=";
+  if (from == 0 || to == 0) {
+    oss << "-";
+  } else {
+    oss << static_cast<double>(to - from) / 1000;
+  }
+}
+
+// slow_request_ms 以上かかったrequestを、区間ごとの内訳 (ms) 付きで出す
+void HttpTransaction::log_slow_request(unsigned long long now,
+                                       unsigned long long routed) {
+  unsigned long long threshold_ms = request_.get_slow_request_ms();
+  if (threshold_ms == 0 || now - times_.received < threshold_ms * 1000) {
+    return;
+  }
+  std::ostringstream oss;
+  oss << "Slow request: " << request_.get_method() << " "
+      << request_.get_path() << " fd=" << client_fd_;
+  append_phase_ms(oss, "total", times_.received, now);
+  append_phase_ms(oss, "wait", times_.accepted, times_.received);
+  append_phase_ms(oss, "parse", times_.received, times_.parsed);
+  append_phase_ms(oss, "route", times_.parsed, routed);
+  append_phase_ms(oss, "handle", routed, times_.responded);
+  LOG(LOG_WARNING, oss.str());
+}
+
+// 積み終えた応答を送り切るまでの時間; 後続のrequestの応答も続けて積まれていれば含む
+void HttpTransaction::on_response_flushed() {
+  if (flush_started_ != 0) {
+    Metrics::get_instance().observe_phase(
+        Metrics::REQUEST_FLUSH, Metrics::now_usec() - flush_started_);
+    flush_started_ = 0;
+  }
+}
+
 void HttpTransaction::process_cgi_session() {
   LOG_DEBUG_FUNC();
   CgiSession *session = request_.get_cgi_session();
 
   session->build_response(response_); // まだdataがなければ何もしない
+  if (times_.responded == 0 && response_.has_response()) {
+    times_.responded = Metrics::now_usec(); // CGIの最初の出力
+  }
   if (session->is_failed() || session->is_session_completed()) {
     bool keep_alive = request_.get_connection_policy() == CP_KEEP_ALIVE;
+    size_t relayed_bytes = session->get_relayed_bytes();
     request_.clear_cgi_session();
+    finish_request(relayed_bytes);
     parser_.clear(); // 次のリクエストへ
     if (keep_alive) {
       process_data();
@@ -88,6 +219,7 @@ void HttpTransaction::handle_client_timeout() {
       request_.clear_cgi_session();
     } else {
       session->mark_client_dead();
+      request_.detach_cgi_session();
     }
   } else {
     response_.generate_timeout_response();
@@ -98,11 +230,15 @@ void HttpTransaction::handle_client_abort() {
   LOG_DEBUG_FUNC();
   if (request_.has_cgi_session()) {
     CgiSession *session = request_.get_cgi_session();
+    size_t relayed_bytes = session->get_relayed_bytes();
     if (session->is_failed() || session->is_session_completed()) {
       request_.clear_cgi_session();
     } else {
       session->mark_client_dead();
+      request_.detach_cgi_session();
     }
+    // CGIの終了を待たずに切断された場合も、そこでrequestは終わったとみなす
+    finish_request(relayed_bytes);
   }
 }
 
@@ -114,7 +250,18 @@ ResponseEntry *HttpTransaction::get_response() {
   return response_.get_front_response();
 }
 
-void HttpTransaction::pop_response() { response_.pop_front_response(); }
+int HttpTransaction::fill_iovec(struct iovec *iov, int max_iov) const {
+  return response_.fill_iovec(iov, max_iov);
+}
+
+// 送信が進んだら、抑制中のCGI読み込みを再開できるか判定する
+void HttpTransaction::pop_response() {
+  response_.pop_front_response();
+  if (request_.has_cgi_session()) {
+    request_.get_cgi_session()->update_read_throttle(
+        response_.get_queued_bytes());
+  }
+}
 
 HttpTransaction &HttpTransaction::operator=(const HttpTransaction &other) {
   (void)other;
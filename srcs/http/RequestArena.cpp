@@ -0,0 +1,101 @@
+#include "RequestArena.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+ArenaStats RequestArena::total_stats_ = {0, 0, 0, 0};
+
+RequestArena::RequestArena()
+    : blocks_(), current_(0), offset_(0), spills_() {
+  std::memset(&stats_, 0, sizeof(stats_));
+}
+
+RequestArena::~RequestArena() {
+  for (size_t i = 0; i < spills_.size(); ++i) {
+    std::free(spills_[i]);
+  }
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    std::free(blocks_[i]);
+  }
+}
+
+void *RequestArena::allocate(size_t size) {
+  size = (size + k_alignment - 1) & ~(k_alignment - 1);
+  if (size == 0) {
+    size = k_alignment;
+  }
+  if (size > k_block_size) {
+    void *spill = std::malloc(size);
+    if (!spill) {
+      throw std::bad_alloc();
+    }
+    spills_.push_back(spill);
+    ++stats_.spills;
+    ++total_stats_.spills;
+    count(size);
+    return spill;
+  }
+  if (blocks_.empty() || offset_ + size > k_block_size) {
+    if (!blocks_.empty()) {
+      ++current_; // 使用中のblockの残りは捨てる
+    }
+    if (current_ == blocks_.size()) {
+      char *block = static_cast<char *>(std::malloc(k_block_size));
+      if (!block) {
+        throw std::bad_alloc();
+      }
+      blocks_.push_back(block);
+      ++stats_.blocks;
+      ++total_stats_.blocks;
+    }
+    offset_ = 0;
+  }
+  void *ptr = blocks_[current_] + offset_;
+  offset_ += size;
+  count(size);
+  return ptr;
+}
+
+// NUL終端したコピーを返す
+char *RequestArena::copy(const char *data, size_t length) {
+  char *dest = static_cast<char *>(allocate(length + 1));
+  std::memcpy(dest, data, length);
+  dest[length] = '\0';
+  return dest;
+}
+
+// 先頭のblockに戻すだけ; spillと保持上限を超えたblockだけを解放する
+void RequestArena::reset() {
+  for (size_t i = 0; i < spills_.size(); ++i) {
+    std::free(spills_[i]);
+  }
+  spills_.clear();
+  while (blocks_.size() > k_max_retained_blocks) {
+    std::free(blocks_.back());
+    blocks_.pop_back();
+  }
+  current_ = 0;
+  offset_ = 0;
+  ++stats_.resets;
+  ++total_stats_.resets;
+}
+
+const ArenaStats &RequestArena::get_stats() const { return stats_; }
+
+const ArenaStats &RequestArena::get_total_stats() { return total_stats_; }
+
+void RequestArena::count(size_t bytes) {
+  stats_.bytes += bytes;
+  total_stats_.bytes += bytes;
+}
+
+RequestArena::RequestArena(const RequestArena &other)
+    : blocks_(), current_(0), offset_(0), spills_() {
+  (void)other;
+  std::memset(&stats_, 0, sizeof(stats_));
+}
+
+RequestArena &RequestArena::operator=(const RequestArena &other) {
+  (void)other;
+  return *this;
+}
@@ -0,0 +1,241 @@
+#include "ResponseTemplates.hpp"
+#include "HeaderWriter.hpp"
+#include "HttpResponse.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include <cstdlib>
+#include <cstring>
+
+ResponseTemplates *ResponseTemplates::instance_ = 0;
+
+// generate_error_response(status, conn) で使われるstatus
+static const int k_error_statuses[] = {400, 403, 404, 405, 408, 413,
+                                       414, 431, 500, 501, 502, 505};
+
+static const char k_timeout_body[] =
+    "<html>\n"
+    "  <head>\n"
+    "    <title>408 Request Timeout</title>\n"
+    "  </head>\n"
+    "  <body>\n"
+    "    <h1>408 Request Timeout</h1>\n"
+    "    <p>Failed to process request in time. Please try again.</p>\n"
+    "  </body>\n"
+    "</html>";
+
+ResponseTemplates &ResponseTemplates::get_instance() {
+  if (!instance_) {
+    instance_ = new ResponseTemplates();
+    std::atexit(ResponseTemplates::delete_instance);
+  }
+  return *instance_;
+}
+
+void ResponseTemplates::delete_instance() {
+  if (instance_) {
+    delete instance_;
+  }
+  instance_ = 0;
+}
+
+// server単体と、各locationをserverに重ねた設定それぞれについて作る
+// (HttpRequest::get_best_match_config() と同じ重ね方)
+void ResponseTemplates::compile(const ServerAndLocationConfigs &configs) {
+  for (size_t i = 0; i < configs.size(); ++i) {
+    const ConfigMap &server_config = configs[i].first;
+    const LocationMap &locations = configs[i].second;
+
+    compile_context(server_config);
+    for (ConstLocationIt it = locations.begin(); it != locations.end(); ++it) {
+      ConfigMap merged = server_config;
+      for (ConstConfigIt c = it->second.begin(); c != it->second.end(); ++c) {
+        merged[c->first] = c->second;
+      }
+      compile_context(merged);
+    }
+  }
+  LOG_FD(LOG_DEBUG, "Compiled custom error page templates: ",
+        custom_errors_.size());
+  LOG_FD(LOG_DEBUG, "Compiled redirect templates: ", redirects_.size());
+}
+
+void ResponseTemplates::compile_context(const ConfigMap &config) {
+  ConstConfigIt root_it = config.find("root");
+  std::string root;
+  if (root_it != config.end() && !root_it->second.empty()) {
+    root = root_it->second[0];
+  }
+
+  // error_page 404 500 /path ...: pathの前に並んだstatusすべてに同じpage
+  ConstConfigIt page_it = config.find("error_page");
+  if (page_it != config.end()) {
+    const StrVector &tokens = page_it->second;
+    std::vector<int> codes;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      if (is_all_digits(tokens[i])) {
+        codes.push_back(std::atoi(tokens[i].c_str()));
+        continue;
+      }
+      const std::string file_path = root + tokens[i];
+      for (size_t j = 0; j < codes.size(); ++j) {
+        Key key(codes[j], file_path);
+        if (custom_errors_.count(key)) {
+          continue;
+        }
+        try {
+          custom_errors_[key] =
+              build(codes[j], "", "text/html", read_file(file_path));
+        } catch (const std::exception &e) {
+          // 読めないpageは、generate_custom_error_page() と同じ代替応答にする
+          LOG(LOG_WARNING, e.what());
+          custom_errors_[key] = build(codes[j], "", "text/plain", "Not Found");
+        }
+      }
+      codes.clear();
+    }
+  }
+
+  // return 301 /new: 不正な値は実行時にHttpRequestが400として扱う
+  ConstConfigIt return_it = config.find("return");
+  if (return_it != config.end() && return_it->second.size() == 2 &&
+      !return_it->second[1].empty()) {
+    try {
+      int status_code = str_to_int(return_it->second[0]);
+      const std::string &location = return_it->second[1];
+      Key key(status_code, location);
+      if (!redirects_.count(key)) {
+        redirects_[key] =
+            build(status_code, location, "", "");
+      }
+    } catch (const std::exception &e) {
+      LOG(LOG_DEBUG, e.what());
+    }
+  }
+}
+
+bool ResponseTemplates::render_error(int status_code, ConnectionPolicy conn,
+                                     std::vector<char> &out) {
+  StatusMap::const_iterator it = errors_.find(status_code);
+  if (it == errors_.end()) {
+    return false;
+  }
+  render(it->second, conn, out);
+  return true;
+}
+
+// messageは呼び出し側の固定文字列なので、初回に作って以降は使い回す
+bool ResponseTemplates::render_error(int status_code,
+                                     const std::string &message,
+                                     ConnectionPolicy conn,
+                                     std::vector<char> &out) {
+  Key key(status_code, message);
+  KeyMap::iterator it = messages_.find(key);
+  if (it == messages_.end()) {
+    Template tmpl = build(status_code, "", "text/plain", message);
+    it = messages_.insert(std::make_pair(key, tmpl)).first;
+  }
+  render(it->second, conn, out);
+  return true;
+}
+
+bool ResponseTemplates::render_custom_error(int status_code,
+                                            const std::string &file_path,
+                                            ConnectionPolicy conn,
+                                            std::vector<char> &out) {
+  KeyMap::const_iterator it = custom_errors_.find(Key(status_code, file_path));
+  if (it == custom_errors_.end()) {
+    return false;
+  }
+  render(it->second, conn, out);
+  return true;
+}
+
+// directoryへの末尾`/`の付与など、requestごとに転送先が変わるものは対象外
+bool ResponseTemplates::render_redirect(int status_code,
+                                        const std::string &location,
+                                        ConnectionPolicy conn,
+                                        std::vector<char> &out) {
+  KeyMap::const_iterator it = redirects_.find(Key(status_code, location));
+  if (it == redirects_.end()) {
+    return false;
+  }
+  render(it->second, conn, out);
+  return true;
+}
+
+void ResponseTemplates::render_timeout(std::vector<char> &out) {
+  render(timeout_, CP_MUST_CLOSE, out);
+}
+
+// 応答全体をcopyし、Date の枠だけを書き換える
+void ResponseTemplates::render(const Template &tmpl, ConnectionPolicy conn,
+                               std::vector<char> &out) {
+  const std::vector<char> &bytes =
+      (conn == CP_KEEP_ALIVE) ? tmpl.keep_alive : tmpl.close;
+  out.assign(bytes.begin(), bytes.end());
+  std::memcpy(&out[tmpl.date_offset], HeaderWriter::http_date(),
+              HeaderWriter::k_date_length);
+}
+
+// Connection違いを2つ作る; Date の位置はどちらも同じ
+ResponseTemplates::Template
+ResponseTemplates::build(int status_code, const std::string &location,
+                         const std::string &content_type,
+                         const std::string &body) {
+  Template tmpl;
+  build_one(tmpl.keep_alive, tmpl.date_offset, status_code, location,
+            content_type, body, CP_KEEP_ALIVE);
+  build_one(tmpl.close, tmpl.date_offset, status_code, location, content_type,
+            body, CP_MUST_CLOSE);
+  return tmpl;
+}
+
+void ResponseTemplates::build_one(std::vector<char> &out, size_t &date_offset,
+                                  int status_code, const std::string &location,
+                                  const std::string &content_type,
+                                  const std::string &body,
+                                  ConnectionPolicy conn) {
+  static const char k_date_placeholder[] = "Thu, 01 Jan 1970 00:00:00 GMT";
+  HeaderWriter writer(out);
+
+  writer.status_line(status_code);
+  if (!location.empty()) {
+    writer.header("Location", location);
+  }
+  writer.header("Content-Length", body.size());
+  if (!content_type.empty()) {
+    writer.header("Content-Type", content_type);
+  }
+  writer.append("Date: ");
+  date_offset = writer.size();
+  writer.append(k_date_placeholder, HeaderWriter::k_date_length);
+  writer.append("\r\n");
+  writer.connection_header(conn);
+  writer.end();
+  writer.append(body);
+  writer.flush();
+}
+
+ResponseTemplates::ResponseTemplates()
+    : errors_(), messages_(), custom_errors_(), redirects_(), timeout_() {
+  for (size_t i = 0; i < sizeof(k_error_statuses) / sizeof(k_error_statuses[0]);
+       ++i) {
+    const int status_code = k_error_statuses[i];
+    errors_[status_code] =
+        build(status_code, "", "text/plain",
+              HttpResponse::get_status_message(status_code));
+  }
+  timeout_ = build(408, "", "text/html", k_timeout_body);
+}
+
+ResponseTemplates::~ResponseTemplates() {}
+
+ResponseTemplates::ResponseTemplates(const ResponseTemplates &other) {
+  (void)other;
+}
+
+ResponseTemplates &
+ResponseTemplates::operator=(const ResponseTemplates &other) {
+  (void)other;
+  return *this;
+}
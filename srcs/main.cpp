@@ -10,49 +10,38 @@
 /*                                                                            */
 /* ************************************************************************** */
 
+#include "AccessLog.hpp"
 #include "CgiRegistry.hpp"
+#include "ChildReaper.hpp"
 #include "ClientRegistry.hpp"
 #include "ConfigParse.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
 #include "Multiplexer.hpp"
+#include "ResponseTemplates.hpp"
 #include "Server.hpp"
 #include "ServerBuilder.hpp"
 #include "ServerRegistry.hpp"
 #include "types.hpp"
-#include <errno.h>
 #include <signal.h>
-#include <sys/wait.h>
 
 static void free_resources() { Multiplexer::delete_instance(); }
 
-static void handle_sigchld(int sig) {
-  const int saved_errno = errno;
-  (void)sig;
-
-  for (;;) {
-    pid_t pid = waitpid(-1, NULL, WNOHANG);
-    if (pid <= 0) {
-      if (pid == -1 && (errno == EINTR || errno == EAGAIN)) {
-        continue;
-      }
-      break;
-    } else {
-      std::cerr << "[SIGCHLD] Reaped child pid: " << pid << std::endl;
-    }
-  }
-
-  errno = saved_errno;
-}
-
+// usage: webserv [-e epoll|io_uring|poll|select] conf
+// -e は設定fileの events { use ...; } より優先する
 int main(int argc, char **argv) {
+  std::string backend;
+  if (argc == 4 && std::string(argv[1]) == "-e") {
+    backend = argv[2];
+    argv += 2;
+    argc -= 2;
+  }
   if (argc != 2)
     return (print_error_message("need conf filename"));
 
-  Multiplexer &multiplexer = Multiplexer::get_instance();
   std::atexit(free_resources);
 
-  signal(SIGPIPE, SIG_IGN);        // client終了時のcrash予防; SIGPIPEを無視
-  signal(SIGCHLD, handle_sigchld); // CGIの子process回収
+  signal(SIGPIPE, SIG_IGN); // client終了時のcrash予防; SIGPIPEを無視
 
   try {
     Parse parser(argv[1]);
@@ -61,16 +50,32 @@ int main(int argc, char **argv) {
     if (server_location_configs.empty())
       throw std::runtime_error("No valid server configurations found.");
 
+    if (backend.empty())
+      backend = parser.get_event_backend();
+    if (!backend.empty() && !Multiplexer::set_backend(backend))
+      throw std::runtime_error("Unsupported event backend: " + backend);
+    Multiplexer &multiplexer = Multiplexer::get_instance();
+    if (parser.get_stall_threshold_ms() >= 0)
+      multiplexer.set_stall_threshold_ms(parser.get_stall_threshold_ms());
+
     ServerRegistry server_registry;
     ClientRegistry client_registry;
     CgiRegistry cgi_registry;
+    ChildReaper child_reaper;
+
+    child_reaper.open(); // CGIの子process回収; 最初のCGI起動より前に
 
     ServerBuilder::build(server_location_configs, server_registry);
+    ServerBuilder::preallocate_pools(server_location_configs);
+    ResponseTemplates::get_instance().compile(server_location_configs);
+    AccessLog::get_instance().open(server_location_configs);
     server_registry.initialize();
 
     multiplexer.set_server_registry(&server_registry);
     multiplexer.set_client_registry(&client_registry);
     multiplexer.set_cgi_registry(&cgi_registry);
+    multiplexer.set_child_reaper(&child_reaper);
+    Metrics::get_instance().set_registries(&client_registry, &cgi_registry);
 
     multiplexer.run();
 
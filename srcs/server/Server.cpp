@@ -15,7 +15,8 @@
 #include <algorithm>
 
 Server::Server(const ConfigMap &config, const LocationMap &locations)
-    : server_config_(config), location_configs_(locations), _is_default(false) {
+    : server_config_(config), location_configs_(locations), _is_default(false),
+      slow_request_ms_(0) {
 
   ConstConfigIt listen_it = config.find("listen");
   if (listen_it != config.end()) {
@@ -27,12 +28,18 @@ Server::Server(const ConfigMap &config, const LocationMap &locations)
       }
     }
   }
+  // 値は Parse::validate_number_values で0以上の整数と確認済み
+  ConstConfigIt slow_it = config.find("slow_request_ms");
+  if (slow_it != config.end() && !slow_it->second.empty()) {
+    slow_request_ms_ = str_to_int(slow_it->second[0]);
+  }
 }
 
 Server::Server(const Server &src) {
   server_config_ = src.server_config_;
   location_configs_ = src.location_configs_;
   _is_default = src._is_default;
+  slow_request_ms_ = src.slow_request_ms_;
 }
 
 Server::~Server() {}
@@ -49,6 +56,8 @@ const std::vector<std::string> &Server::get_server_names() const {
 
 bool Server::is_default_server() const { return _is_default; }
 
+size_t Server::get_slow_request_ms() const { return slow_request_ms_; }
+
 Server &Server::operator=(const Server &src) {
   (void)src;
   return *this;
@@ -1,8 +1,44 @@
 #include "ServerBuilder.hpp"
+#include "CgiSession.hpp"
+#include "Client.hpp"
+#include "Logger.hpp"
+#include "ObjectPool.hpp"
 #include "Server.hpp"
 #include "ServerRegistry.hpp"
+#include "Utils.hpp"
+#include <algorithm>
 #include <stdexcept>
 
+// 全serverのうち最大の値を使う; どのserverにもなければ -1
+static int find_pool_size(const ServerAndLocationConfigs &config_pairs,
+                          const std::string &key) {
+  int pool_size = -1;
+  for (size_t i = 0; i < config_pairs.size(); i++) {
+    ConstConfigIt it = config_pairs[i].first.find(key);
+    if (it == config_pairs[i].first.end() || it->second.empty()) {
+      continue;
+    }
+    try {
+      pool_size = std::max(pool_size, std::max(str_to_int(it->second[0]), 0));
+    } catch (const std::exception &e) {
+      LOG(LOG_WARNING, e.what());
+    }
+  }
+  return pool_size;
+}
+
+template <typename T>
+static void configure_pool(const ServerAndLocationConfigs &config_pairs,
+                           const std::string &key) {
+  int pool_size = find_pool_size(config_pairs, key);
+  if (pool_size < 0) {
+    return; // 既定の上限のまま, 事前確保はしない
+  }
+  ObjectPool<T> &pool = ObjectPool<T>::get_instance();
+  pool.set_capacity(pool_size);
+  pool.preallocate(pool_size);
+}
+
 void ServerBuilder::build(const ServerAndLocationConfigs &config_pairs,
                           ServerRegistry &registry) {
   if (config_pairs.empty()) {
@@ -13,3 +49,11 @@ void ServerBuilder::build(const ServerAndLocationConfigs &config_pairs,
     registry.add(server);
   }
 }
+
+// client_pool_size / cgi_session_pool_size:
+// 起動時にN個作っておき、接続終了後もN個まで再利用のために残す (0で無効)
+void ServerBuilder::preallocate_pools(
+    const ServerAndLocationConfigs &config_pairs) {
+  configure_pool<Client>(config_pairs, "client_pool_size");
+  configure_pool<CgiSession>(config_pairs, "cgi_session_pool_size");
+}
@@ -24,7 +24,7 @@ ServerRegistry::ServerRegistry() {}
 ServerRegistry::~ServerRegistry() {
   for (size_t i = 0; i < entries.size(); ++i) {
     if (entries[i].fd != -1 && close(entries[i].fd) == -1) {
-      logfd(LOG_ERROR, "Failed to close server fd: ", entries[i].fd);
+      LOG_FD(LOG_ERROR, "Failed to close server fd: ", entries[i].fd);
     }
     delete entries[i].virtual_host_router;
   }
@@ -34,9 +34,20 @@ void ServerRegistry::add(const Server &s) {
   std::vector<std::string> ip_ports = s.get_config().find("listen")->second;
   std::string ip, port;
 
+  // parameterは同じlisten directiveの全addressに適用する
+  ListenOptions options;
+  bool has_options = false;
+  for (size_t i = 0; i < ip_ports.size(); ++i) {
+    SocketBuilder::parse_listen_option(ip_ports[i], options);
+    if (SocketBuilder::is_listen_option(ip_ports[i]) &&
+        ip_ports[i] != "default_server") {
+      has_options = true;
+    }
+  }
+
   for (size_t i = 0; i < ip_ports.size(); ++i) {
 
-    if (ip_ports[i] == "default_server")
+    if (SocketBuilder::is_listen_option(ip_ports[i]))
       continue;
     size_t colon_pos = ip_ports[i].find(':');
     if (colon_pos == std::string::npos) {
@@ -50,12 +61,17 @@ void ServerRegistry::add(const Server &s) {
     size_t j;
     for (j = 0; j < entries.size(); ++j) {
       if (ip == entries[j].ip && port == entries[j].port) {
+        // parameterを書けるのはip:portごとに1つのserverだけ (Parseで確認済み)
+        // 後のserverに書かれていても、そのsocketに適用する
+        if (has_options) {
+          entries[j].options = options;
+        }
         entries[j].virtual_host_router->add(new Server(s));
         break;
       }
     }
     if (j == entries.size()) {
-      create_new_listen_target(ip, port, s);
+      create_new_listen_target(ip, port, options, s);
     }
   }
 }
@@ -64,7 +80,7 @@ void ServerRegistry::remove(int fd) {
   for (ListenEntryIt it = entries.begin(); it != entries.end(); ++it) {
     if (it->fd == fd) {
       if (close(it->fd) == -1) {
-        logfd(LOG_ERROR, "Failed to close server fd: ", it->fd);
+        LOG_FD(LOG_ERROR, "Failed to close server fd: ", it->fd);
       }
       delete it->virtual_host_router;
       entries.erase(it);
@@ -86,7 +102,8 @@ size_t ServerRegistry::size() const { return entries.size(); }
 
 void ServerRegistry::initialize() {
   for (size_t i = 0; i < entries.size(); ++i) {
-    int fd = SocketBuilder::create_socket(entries[i].ip, entries[i].port);
+    int fd = SocketBuilder::create_socket(entries[i].ip, entries[i].port,
+                                          entries[i].options);
     entries[i].fd = fd;
     Multiplexer::get_instance().monitor_read(fd);
   }
@@ -101,13 +118,24 @@ const VirtualHostRouter *ServerRegistry::get_router(int fd) const {
   return NULL;
 }
 
+const ListenOptions *ServerRegistry::get_listen_options(int fd) const {
+  for (ConstListenEntryIt it = entries.begin(); it != entries.end(); ++it) {
+    if (it->fd == fd) {
+      return &it->options;
+    }
+  }
+  return NULL;
+}
+
 void ServerRegistry::create_new_listen_target(const std::string &ip,
                                               const std::string &port,
+                                              const ListenOptions &options,
                                               const Server &s) {
   struct ListenEntry entry;
   entry.fd = -1;
   entry.ip = ip;
   entry.port = port;
+  entry.options = options;
   entry.virtual_host_router = new VirtualHostRouter;
   entry.virtual_host_router->add(new Server(s));
   entries.push_back(entry);
@@ -1,14 +1,36 @@
 #include "SocketBuilder.hpp"
 #include "Logger.hpp"
+#include "Utils.hpp"
 #include "unistd.h"
 #include <cstring>
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
 #include <sys/socket.h>
 #include <sys/types.h>
 
-int SocketBuilder::create_socket(const std::string &ip,
-                                 const std::string &port) {
+// TCP_DEFER_ACCEPT: この秒数だけdataを待つ (過ぎたら通常どおりacceptされる)
+static const int k_defer_accept_sec = 1;
+
+ListenOptions::ListenOptions()
+    : backlog(SOMAXCONN), deferred(false), fastopen(0), nodelay(true),
+      cork(true) {}
+
+static bool parse_on_off(const std::string &name, const std::string &value) {
+  if (value == "on") {
+    return true;
+  }
+  if (value == "off") {
+    return false;
+  }
+  throw std::runtime_error("Invalid " + name +
+                           " in listen directive (on|off): " + value);
+}
+
+int SocketBuilder::create_socket(const std::string &ip, const std::string &port,
+                                 const ListenOptions &options) {
   int sockfd = -1, status, opt = 1;
   struct addrinfo hints, *ai, *p;
 
@@ -36,8 +58,12 @@ int SocketBuilder::create_socket(const std::string &ip,
     }
     if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK) == -1 ||
         setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1 ||
-        bind(sockfd, p->ai_addr, p->ai_addrlen) == -1 ||
-        listen(sockfd, SOMAXCONN) == -1) {
+        bind(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
+      close(sockfd);
+      continue;
+    }
+    apply_listen_options(sockfd, options); // TCP_FASTOPEN はlisten()より前に
+    if (listen(sockfd, options.backlog) == -1) {
       close(sockfd);
       continue;
     }
@@ -47,6 +73,83 @@ int SocketBuilder::create_socket(const std::string &ip,
   if (!p) {
     throw std::runtime_error("Failed to prepare socket for " + ip + ":" + clean_port);
   }
-  logfd(LOG_INFO, "Now listening on " + ip + ":" + clean_port + " fd: ", sockfd);
+  LOG_FD(LOG_INFO, "Now listening on " + ip + ":" + clean_port + " fd: ", sockfd);
   return sockfd;
 }
+
+// addressではなくparameterのtokenか (値の検証は parse_listen_option)
+bool SocketBuilder::is_listen_option(const std::string &token) {
+  return (token == "default_server" || token == "deferred" ||
+          token.find('=') != std::string::npos);
+}
+
+// 知らないparameterなら false; 値が不正なら例外
+bool SocketBuilder::parse_listen_option(const std::string &token,
+                                        ListenOptions &options) {
+  if (token == "default_server") {
+    return true;
+  }
+  if (token == "deferred") {
+    options.deferred = true;
+    return true;
+  }
+  size_t eq = token.find('=');
+  if (eq == std::string::npos) {
+    return false;
+  }
+  const std::string name = token.substr(0, eq);
+  const std::string value = token.substr(eq + 1);
+  if (name == "backlog") {
+    int backlog = str_to_int(value);
+    if (backlog <= 0) {
+      throw std::runtime_error("Invalid backlog in listen directive: " + value);
+    }
+    options.backlog = backlog;
+    return true;
+  }
+  if (name == "fastopen") {
+    int fastopen = str_to_int(value);
+    if (fastopen < 0) {
+      throw std::runtime_error("Invalid fastopen in listen directive: " +
+                               value);
+    }
+    options.fastopen = fastopen;
+    return true;
+  }
+  if (name == "nodelay") {
+    options.nodelay = parse_on_off(name, value);
+    return true;
+  }
+  if (name == "cork") {
+    options.cork = parse_on_off(name, value);
+    return true;
+  }
+  return false;
+}
+
+// 使えないOS / kernel設定では警告だけ出し、通常のsocketとして続ける
+void SocketBuilder::apply_listen_options(int sockfd,
+                                         const ListenOptions &options) {
+  if (options.deferred) {
+#if defined(TCP_DEFER_ACCEPT)
+    int timeout = k_defer_accept_sec;
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &timeout,
+                   sizeof(timeout)) == -1) {
+      LOG_FD(LOG_WARNING, "Failed to set TCP_DEFER_ACCEPT on socket: ", sockfd);
+    }
+#else
+    LOG(LOG_WARNING, "deferred is not supported on this platform");
+#endif
+  }
+  if (options.fastopen > 0) {
+#if defined(TCP_FASTOPEN)
+    int qlen = options.fastopen;
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) ==
+        -1) {
+      LOG_FD(LOG_WARNING, "Failed to set TCP_FASTOPEN on socket: ", sockfd);
+    }
+#else
+    LOG(LOG_WARNING, "fastopen is not supported on this platform");
+#endif
+  }
+}
@@ -0,0 +1,397 @@
+#include "AccessLog.hpp"
+#include "HttpRequest.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+// nginxの combined に処理時間を足したもの
+static const char *k_default_format =
+    "$remote_addr - - [$time_local] \"$request\" $status $bytes_sent "
+    "\"$http_referer\" \"$http_user_agent\" $request_time";
+
+AccessLog *AccessLog::instance_ = 0;
+
+void AccessLog::create_instance() {
+  instance_ = new AccessLog();
+  std::atexit(AccessLog::delete_instance);
+}
+
+void AccessLog::delete_instance() {
+  if (instance_) {
+    delete instance_;
+  }
+  instance_ = 0;
+}
+
+// server blockごとの access_log / log_format から、pathごとの出力先を開く
+void AccessLog::open(const ServerAndLocationConfigs &configs) {
+  for (size_t i = 0; i < configs.size(); ++i) {
+    open_sink(configs[i].first);
+  }
+  last_flush_ = time(NULL);
+}
+
+// access_log がなければ (offも) false; 書き方が不正ならthrow
+bool AccessLog::parse_directive(const ConfigMap &config, std::string &path,
+                                bool &json, std::string &format) {
+  format = k_default_format;
+  ConstConfigIt format_it = config.find("log_format");
+  if (format_it != config.end() && !format_it->second.empty()) {
+    // 空白で分割された値を、1つの書式に戻す
+    format = format_it->second[0];
+    for (size_t i = 1; i < format_it->second.size(); ++i) {
+      format += " " + format_it->second[i];
+    }
+  }
+  ConstConfigIt it = config.find("access_log");
+  if (it == config.end() || it->second.empty()) {
+    return false;
+  }
+  const StrVector &values = it->second;
+  if (values[0] == "off" && values.size() == 1) {
+    return false;
+  }
+  if (values[0] == "off" || values.size() > 2 ||
+      (values.size() == 2 && values[1] != "text" && values[1] != "json")) {
+    throw std::runtime_error("Invalid access_log directive: usage is "
+                             "access_log <path> [text|json]; or "
+                             "access_log off;");
+  }
+  path = values[0];
+  json = values.size() == 2 && values[1] == "json";
+  return true;
+}
+
+// 起動時の設定の確認で呼ばれる; 書式の変数もここで確かめる
+void AccessLog::validate(const ConfigMap &config) {
+  std::string path;
+  bool json;
+  std::string format;
+  std::vector<Token> tokens;
+
+  parse_directive(config, path, json, format);
+  compile_format(format, tokens);
+}
+
+void AccessLog::open_sink(const ConfigMap &config) {
+  std::string path;
+  bool json;
+  std::string format;
+  if (!parse_directive(config, path, json, format)) {
+    return;
+  }
+
+  std::map<std::string, Sink>::iterator sink_it = sinks_.find(path);
+  if (sink_it != sinks_.end()) {
+    if (sink_it->second.format != format || sink_it->second.json != json) {
+      throw std::runtime_error("Conflicting log formats for access_log: " +
+                               path);
+    }
+    return;
+  }
+  Sink sink;
+  sink.json = json;
+  sink.format = format;
+  compile_format(format, sink.tokens);
+  sink.fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                   0644);
+  if (sink.fd == -1) {
+    throw std::runtime_error("Cannot open access_log " + path + ": " +
+                             strerror(errno));
+  }
+  sinks_[path] = sink;
+  sinks_[path].buffer.reserve(k_flush_bytes * 2);
+}
+
+// "$name" を変数, それ以外をliteralとして、書式を順に並べる
+void AccessLog::compile_format(const std::string &format,
+                               std::vector<Token> &tokens) {
+  static const struct {
+    const char *name;
+    Field field;
+  } variables[] = {{"remote_addr", FIELD_REMOTE_ADDR},
+                   {"time_local", FIELD_TIME_LOCAL},
+                   {"time_iso8601", FIELD_TIME_ISO8601},
+                   {"request", FIELD_REQUEST},
+                   {"request_method", FIELD_REQUEST_METHOD},
+                   {"request_uri", FIELD_REQUEST_URI},
+                   {"server_protocol", FIELD_SERVER_PROTOCOL},
+                   {"status", FIELD_STATUS},
+                   {"bytes_sent", FIELD_BYTES_SENT},
+                   {"request_time", FIELD_REQUEST_TIME},
+                   {"host", FIELD_HOST},
+                   {"http_referer", FIELD_HTTP_REFERER},
+                   {"http_user_agent", FIELD_HTTP_USER_AGENT}};
+  static const size_t variable_count = sizeof(variables) / sizeof(variables[0]);
+
+  size_t pos = 0;
+  while (pos < format.size()) {
+    Token token;
+    if (format[pos] != '$') {
+      size_t next = format.find('$', pos);
+      if (next == std::string::npos) {
+        next = format.size();
+      }
+      token.field = FIELD_LITERAL;
+      token.text = format.substr(pos, next - pos);
+      tokens.push_back(token);
+      pos = next;
+      continue;
+    }
+    size_t end = pos + 1;
+    while (end < format.size() &&
+           (std::isalnum(static_cast<unsigned char>(format[end])) ||
+            format[end] == '_')) {
+      ++end;
+    }
+    token.text = format.substr(pos + 1, end - pos - 1);
+    size_t i = 0;
+    while (i < variable_count && token.text != variables[i].name) {
+      ++i;
+    }
+    if (i == variable_count) {
+      throw std::runtime_error("Unknown variable in log_format: $" +
+                               token.text);
+    }
+    token.field = variables[i].field;
+    tokens.push_back(token);
+    pos = end;
+  }
+}
+
+void AccessLog::write(const AccessLogRecord &record) {
+  ConstConfigIt it = record.request->server_config_->find("access_log");
+  if (it == record.request->server_config_->end() || it->second.empty()) {
+    return;
+  }
+  std::map<std::string, Sink>::iterator sink_it = sinks_.find(it->second[0]);
+  if (sink_it == sinks_.end()) {
+    return; // access_log off
+  }
+  Sink &sink = sink_it->second;
+  if (sink.buffer.size() >= k_max_buffer_bytes) {
+    ++dropped_lines_; // 書き込みが失敗し続けている
+    return;
+  }
+  if (sink.json) {
+    append_json(sink.buffer, sink.tokens, record);
+  } else {
+    append_text(sink.buffer, sink.tokens, record);
+  }
+  sink.buffer += '\n';
+  if (sink.buffer.size() >= k_flush_bytes) {
+    flush_sink(sink_it->first, sink);
+  }
+}
+
+void AccessLog::append_text(std::string &out, const std::vector<Token> &tokens,
+                            const AccessLogRecord &record) {
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens[i].field == FIELD_LITERAL) {
+      out += tokens[i].text;
+    } else {
+      append_field(out, tokens[i].field, record, false);
+    }
+  }
+}
+
+// literalは使わず、変数名をkeyにする
+void AccessLog::append_json(std::string &out, const std::vector<Token> &tokens,
+                            const AccessLogRecord &record) {
+  bool first = true;
+  out += '{';
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens[i].field == FIELD_LITERAL) {
+      continue;
+    }
+    if (!first) {
+      out += ',';
+    }
+    first = false;
+    out += '"';
+    out += tokens[i].text;
+    out += "\":";
+    append_field(out, tokens[i].field, record, true);
+  }
+  out += '}';
+}
+
+// requestから来た文字列は、引用符・制御文字・非ASCIIをescapeして書く
+static void append_escaped(std::string &out, const std::string &value,
+                           bool json) {
+  char hex[8];
+  if (json) {
+    out += '"';
+  } else if (value.empty()) {
+    out += '-';
+    return;
+  }
+  for (size_t i = 0; i < value.size(); ++i) {
+    unsigned char c = static_cast<unsigned char>(value[i]);
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += static_cast<char>(c);
+    } else if (c < 0x20 || c >= 0x7f) {
+      snprintf(hex, sizeof(hex), json ? "\\u%04x" : "\\x%02X", c);
+      out += hex;
+    } else {
+      out += static_cast<char>(c);
+    }
+  }
+  if (json) {
+    out += '"';
+  }
+}
+
+static void append_number(std::string &out, unsigned long long value) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%llu", value);
+  out += buf;
+}
+
+static std::string peer_address(int fd) {
+  std::string address;
+  int port;
+
+  if (!get_socket_address(fd, true, address, port)) {
+    return std::string();
+  }
+  return address;
+}
+
+void AccessLog::append_field(std::string &out, Field field,
+                             const AccessLogRecord &record, bool json) {
+  const HttpRequest &request = *record.request;
+  char buf[32];
+
+  switch (field) {
+  case FIELD_REMOTE_ADDR:
+    append_escaped(out, peer_address(record.client_fd), json);
+    break;
+  case FIELD_TIME_LOCAL:
+    update_time_cache();
+    append_escaped(out, time_local_, json);
+    break;
+  case FIELD_TIME_ISO8601:
+    update_time_cache();
+    append_escaped(out, time_iso8601_, json);
+    break;
+  case FIELD_REQUEST:
+    append_escaped(out,
+                   request.get_method() + " " + request.get_path() + " " +
+                       request.get_version(),
+                   json);
+    break;
+  case FIELD_REQUEST_METHOD:
+    append_escaped(out, request.get_method(), json);
+    break;
+  case FIELD_REQUEST_URI:
+    append_escaped(out, request.get_path(), json);
+    break;
+  case FIELD_SERVER_PROTOCOL:
+    append_escaped(out, request.get_version(), json);
+    break;
+  case FIELD_STATUS:
+    append_number(out, record.status);
+    break;
+  case FIELD_BYTES_SENT:
+    append_number(out, record.bytes_sent);
+    break;
+  case FIELD_REQUEST_TIME:
+    snprintf(buf, sizeof(buf), "%llu.%03llu",
+                  record.request_usec / 1000000,
+                  record.request_usec / 1000 % 1000);
+    out += buf;
+    break;
+  case FIELD_HOST:
+    append_escaped(out, request.get_header_value("Host"), json);
+    break;
+  case FIELD_HTTP_REFERER:
+    append_escaped(out, request.get_header_value("Referer"), json);
+    break;
+  case FIELD_HTTP_USER_AGENT:
+    append_escaped(out, request.get_header_value("User-Agent"), json);
+    break;
+  case FIELD_LITERAL:
+  default:
+    break;
+  }
+}
+
+// 時刻の文字列は秒が変わったときだけ作り直す
+void AccessLog::update_time_cache() {
+  time_t now = time(NULL);
+  if (now == cached_time_) {
+    return;
+  }
+  struct tm local;
+  char buf[64];
+  localtime_r(&now, &local);
+  strftime(buf, sizeof(buf), "%d/%b/%Y:%H:%M:%S %z", &local);
+  time_local_ = buf;
+  strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S%z", &local);
+  time_iso8601_ = buf;
+  cached_time_ = now;
+}
+
+void AccessLog::flush_if_due(time_t now) {
+  if (now - last_flush_ >= k_flush_interval_sec) {
+    flush();
+  }
+}
+
+void AccessLog::flush() {
+  for (std::map<std::string, Sink>::iterator it = sinks_.begin();
+       it != sinks_.end(); ++it) {
+    flush_sink(it->first, it->second);
+  }
+  last_flush_ = time(NULL);
+  if (dropped_lines_ != 0) {
+    std::ostringstream oss;
+    oss << "access_log: dropped " << dropped_lines_ << " lines";
+    LOG(LOG_WARNING, oss.str());
+    dropped_lines_ = 0;
+  }
+}
+
+// 一部だけ書けたら続きを書く; 書けなかった分はbufferに残し、次のflushで再び試す
+void AccessLog::flush_sink(const std::string &path, Sink &sink) {
+  size_t written = 0;
+  while (written < sink.buffer.size()) {
+    ssize_t ret = ::write(sink.fd, sink.buffer.data() + written,
+                          sink.buffer.size() - written);
+    if (ret <= 0) {
+      LOG(LOG_ERROR, "Failed to write access_log " + path);
+      break;
+    }
+    written += ret;
+  }
+  sink.buffer.erase(0, written);
+}
+
+AccessLog::AccessLog()
+    : sinks_(), last_flush_(0), cached_time_(0), time_local_(),
+      time_iso8601_(), dropped_lines_(0) {}
+
+AccessLog::~AccessLog() {
+  flush();
+  for (std::map<std::string, Sink>::iterator it = sinks_.begin();
+       it != sinks_.end(); ++it) {
+    close(it->second.fd);
+  }
+}
+
+AccessLog::AccessLog(const AccessLog &other) { (void)other; }
+
+AccessLog &AccessLog::operator=(const AccessLog &other) {
+  (void)other;
+  return *this;
+}
@@ -3,10 +3,6 @@
 #include <cstring>
 #include <sstream>
 
-#ifndef LOG_LEVEL
-#define LOG_LEVEL LOG_INFO
-#endif
-
 LogLevel current_log_level = static_cast<LogLevel>(LOG_LEVEL);
 
 void log(LogLevel level, const std::string &message) {
@@ -0,0 +1,255 @@
+#include "Metrics.hpp"
+#include "CgiRegistry.hpp"
+#include "CgiSession.hpp"
+#include "Client.hpp"
+#include "ClientRegistry.hpp"
+#include "Multiplexer.hpp"
+#include "ObjectPool.hpp"
+#include "RequestArena.hpp"
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <time.h>
+
+LatencyHistogram::LatencyHistogram() : count_(0), sum_(0) {
+  for (int i = 0; i < k_buckets; ++i) {
+    buckets_[i] = 0;
+  }
+}
+
+void LatencyHistogram::observe(unsigned long long usec) {
+  int index = 0;
+  for (unsigned long long v = usec; v != 0 && index < k_buckets - 1; v >>= 1) {
+    ++index;
+  }
+  ++buckets_[index];
+  ++count_;
+  sum_ += usec;
+}
+
+unsigned long long LatencyHistogram::get_count() const { return count_; }
+
+unsigned long long LatencyHistogram::get_sum() const { return sum_; }
+
+unsigned long long LatencyHistogram::get_bucket(int index) const {
+  return buckets_[index];
+}
+
+Metrics *Metrics::instance_ = 0;
+
+void Metrics::create_instance() {
+  instance_ = new Metrics();
+  std::atexit(Metrics::delete_instance);
+}
+
+void Metrics::delete_instance() {
+  if (instance_) {
+    delete instance_;
+  }
+  instance_ = 0;
+}
+
+unsigned long long Metrics::now_usec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<unsigned long long>(ts.tv_sec) * 1000000ULL +
+         ts.tv_nsec / 1000;
+}
+
+void Metrics::set_registries(const ClientRegistry *clients,
+                             const CgiRegistry *cgis) {
+  clients_ = clients;
+  cgis_ = cgis;
+}
+
+void Metrics::count_response(int status_code) {
+  if (status_code < 0 || status_code >= k_max_status) {
+    status_code = 0;
+  }
+  ++responses_[status_code];
+}
+
+// マイクロ秒を "秒.6桁" で出す; doubleを経由しないので、
+// 累計が大きくなっても指数表記や桁落ちにならない
+static void write_seconds(std::ostringstream &oss, unsigned long long usec) {
+  oss << usec / 1000000 << "." << std::setw(6) << std::setfill('0')
+      << usec % 1000000 << std::setfill(' ');
+}
+
+static void write_header(std::ostringstream &oss, const char *name,
+                         const char *type, const char *help) {
+  oss << "# HELP " << name << " " << help << "\n"
+      << "# TYPE " << name << " " << type << "\n";
+}
+
+static void write_pool(std::ostringstream &oss, const char *pool,
+                       const PoolStats &stats) {
+  static const char *name = "webserv_pool_objects_total";
+  oss << name << "{pool=\"" << pool << "\",result=\"created\"} "
+      << stats.created << "\n"
+      << name << "{pool=\"" << pool << "\",result=\"reused\"} " << stats.reused
+      << "\n"
+      << name << "{pool=\"" << pool << "\",result=\"released\"} "
+      << stats.released << "\n"
+      << name << "{pool=\"" << pool << "\",result=\"discarded\"} "
+      << stats.discarded << "\n";
+}
+
+// bucketは累積値で、空でない最大のbucketまでと +Inf を出す
+// labelsは "phase=\"parse\"" のような追加のlabel (なければ空)
+static void write_histogram(std::ostringstream &oss, const char *name,
+                            const std::string &labels,
+                            const LatencyHistogram &histogram) {
+  const std::string prefix = labels.empty() ? "" : labels + ",";
+  const std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+  int last = 0;
+  for (int i = 0; i < LatencyHistogram::k_buckets; ++i) {
+    if (histogram.get_bucket(i) != 0) {
+      last = i;
+    }
+  }
+  unsigned long long cumulative = 0;
+  for (int i = 0; i <= last; ++i) {
+    cumulative += histogram.get_bucket(i);
+    oss << name << "_bucket{" << prefix << "le=\"";
+    write_seconds(oss, 1ULL << i);
+    oss << "\"} " << cumulative << "\n";
+  }
+  oss << name << "_bucket{" << prefix << "le=\"+Inf\"} "
+      << histogram.get_count() << "\n"
+      << name << "_sum" << suffix << " ";
+  write_seconds(oss, histogram.get_sum());
+  oss << "\n"
+      << name << "_count" << suffix << " " << histogram.get_count() << "\n";
+}
+
+void Metrics::render(std::string &out) const {
+  static const char *timeout_kinds[TIMEOUT_KINDS] = {"client", "cgi",
+                                                     "unresponsive"};
+  static const char *phases[PHASE_COUNT] = {"accept", "read", "process",
+                                            "flush"};
+  static const char *request_phases[REQUEST_PHASES] = {
+      "wait", "parse", "route", "handle", "flush"};
+  std::ostringstream oss;
+
+  write_header(oss, "webserv_uptime_seconds", "gauge",
+               "Seconds since the server started.");
+  oss << "webserv_uptime_seconds " << (now_usec() - started_at_) / 1000000
+      << "\n";
+
+  write_header(oss, "webserv_connections_active", "gauge",
+               "Client connections currently open.");
+  oss << "webserv_connections_active "
+      << (clients_ ? clients_->get_client_count() : 0) << "\n";
+  write_header(oss, "webserv_connections_accepted_total", "counter",
+               "Client connections accepted.");
+  oss << "webserv_connections_accepted_total " << accepts_ << "\n";
+
+  write_header(oss, "webserv_cgi_sessions_active", "gauge",
+               "CGI and FastCGI requests in flight.");
+  oss << "webserv_cgi_sessions_active "
+      << (cgis_ ? cgis_->get_session_count() : 0) << "\n";
+
+  write_header(oss, "webserv_responses_total", "counter",
+               "Responses generated, by status code.");
+  for (int code = 0; code < k_max_status; ++code) {
+    if (responses_[code] != 0) {
+      oss << "webserv_responses_total{code=\"" << code << "\"} "
+          << responses_[code] << "\n";
+    }
+  }
+
+  write_header(oss, "webserv_received_bytes_total", "counter",
+               "Bytes read from client sockets.");
+  oss << "webserv_received_bytes_total " << bytes_in_ << "\n";
+  write_header(oss, "webserv_sent_bytes_total", "counter",
+               "Bytes written to client sockets, including spliced CGI output.");
+  oss << "webserv_sent_bytes_total " << bytes_out_ << "\n";
+
+  write_header(oss, "webserv_timeouts_total", "counter",
+               "Timeouts detected by the event loop.");
+  for (int kind = 0; kind < TIMEOUT_KINDS; ++kind) {
+    oss << "webserv_timeouts_total{kind=\"" << timeout_kinds[kind] << "\"} "
+        << timeouts_[kind] << "\n";
+  }
+
+  write_header(oss, "webserv_event_loop_iterations_total", "counter",
+               "Event loop iterations.");
+  oss << "webserv_event_loop_iterations_total " << loop_iterations_ << "\n";
+  write_header(oss, "webserv_event_loop_busy_seconds", "histogram",
+               "Time per event loop iteration spent handling events and "
+               "timeouts, excluding the wait for events.");
+  write_histogram(oss, "webserv_event_loop_busy_seconds", "", loop_latency_);
+  write_header(oss, "webserv_event_loop_stalls_total", "counter",
+               "Event handlers that ran longer than stall_threshold_ms.");
+  oss << "webserv_event_loop_stalls_total " << stalls_ << "\n";
+  const LoopStats &loop = Multiplexer::get_instance().get_loop_stats();
+  write_header(oss, "webserv_event_loop_events_total", "counter",
+               "Events returned by the multiplexer (phased backends only).");
+  oss << "webserv_event_loop_events_total " << loop.events << "\n";
+  write_header(oss, "webserv_event_loop_phase_seconds_total", "counter",
+               "Time spent in each event loop phase.");
+  for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+    oss << "webserv_event_loop_phase_seconds_total{phase=\"" << phases[phase]
+        << "\"} ";
+    write_seconds(oss, loop.usec[phase]);
+    oss << "\n";
+  }
+
+  write_header(oss, "webserv_pool_objects_total", "counter",
+               "Object pool activity.");
+  write_pool(oss, "client", ObjectPool<Client>::get_instance().get_stats());
+  write_pool(oss, "cgi_session",
+             ObjectPool<CgiSession>::get_instance().get_stats());
+  const ArenaStats &arena = RequestArena::get_total_stats();
+  write_header(oss, "webserv_request_arena_bytes_total", "counter",
+               "Bytes allocated from per-request arenas.");
+  oss << "webserv_request_arena_bytes_total " << arena.bytes << "\n";
+  write_header(oss, "webserv_request_arena_resets_total", "counter",
+               "Per-request arenas reset after a request was parsed.");
+  oss << "webserv_request_arena_resets_total " << arena.resets << "\n";
+  write_header(oss, "webserv_request_arena_spills_total", "counter",
+               "Arena allocations too large for a block, served by malloc.");
+  oss << "webserv_request_arena_spills_total " << arena.spills << "\n";
+  write_header(oss, "webserv_request_arena_blocks_total", "counter",
+               "Blocks allocated by per-request arenas.");
+  oss << "webserv_request_arena_blocks_total " << arena.blocks << "\n";
+
+  write_header(oss, "webserv_request_duration_seconds", "histogram",
+               "Time from the first byte of a request until its response is queued.");
+  write_histogram(oss, "webserv_request_duration_seconds", "",
+                  request_latency_);
+  write_header(oss, "webserv_request_phase_seconds", "histogram",
+               "Time spent in each phase of a request: wait (accept to first "
+               "byte), parse, route, handle (until the first response byte "
+               "is queued) and flush (until the queued response is written).");
+  for (int phase = 0; phase < REQUEST_PHASES; ++phase) {
+    write_histogram(oss, "webserv_request_phase_seconds",
+                    std::string("phase=\"") + request_phases[phase] + "\"",
+                    phase_latency_[phase]);
+  }
+
+  out = oss.str();
+}
+
+Metrics::Metrics()
+    : clients_(NULL), cgis_(NULL), started_at_(now_usec()), accepts_(0),
+      loop_iterations_(0), bytes_in_(0), bytes_out_(0), stalls_(0),
+      request_latency_(), loop_latency_(), slowest_op_(NULL),
+      slowest_op_usec_(0) {
+  for (int i = 0; i < TIMEOUT_KINDS; ++i) {
+    timeouts_[i] = 0;
+  }
+  for (int i = 0; i < k_max_status; ++i) {
+    responses_[i] = 0;
+  }
+}
+
+Metrics::~Metrics() {}
+
+Metrics::Metrics(const Metrics &other) { (void)other; }
+
+Metrics &Metrics::operator=(const Metrics &other) {
+  (void)other;
+  return *this;
+}
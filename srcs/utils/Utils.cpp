@@ -11,7 +11,9 @@
 /* ************************************************************************** */
 
 #include "Utils.hpp"
+#include <arpa/inet.h>
 #include <limits>
+#include <sys/socket.h>
 
 int print_error_message(const std::string &message) {
   std::cerr << "Error: " << message << std::endl;
@@ -206,9 +208,32 @@ std::string getExtension(const std::string& path)
     return filename.substr(dot);
 }
 
-std::string get_date() {
-  char buf[100];
-  std::time_t now = std::time(NULL);
-  std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", std::gmtime(&now));
-  return std::string(buf);
+
+bool get_socket_address(int fd, bool peer, std::string &address, int &port) {
+  struct sockaddr_storage addr;
+  socklen_t length = sizeof(addr);
+  char buf[INET6_ADDRSTRLEN];
+  struct sockaddr *sa = reinterpret_cast<struct sockaddr *>(&addr);
+
+  int ret = peer ? getpeername(fd, sa, &length) : getsockname(fd, sa, &length);
+  if (ret == -1) {
+    return false;
+  }
+  const void *src;
+  if (addr.ss_family == AF_INET) {
+    struct sockaddr_in *in = reinterpret_cast<struct sockaddr_in *>(&addr);
+    src = &in->sin_addr;
+    port = ntohs(in->sin_port);
+  } else if (addr.ss_family == AF_INET6) {
+    struct sockaddr_in6 *in6 = reinterpret_cast<struct sockaddr_in6 *>(&addr);
+    src = &in6->sin6_addr;
+    port = ntohs(in6->sin6_port);
+  } else {
+    return false;
+  }
+  if (!inet_ntop(addr.ss_family, src, buf, sizeof(buf))) {
+    return false;
+  }
+  address = buf;
+  return true;
 }
@@ -0,0 +1,55 @@
+#!/bin/bash
+# listen parameter (deferred / fastopen) の有無で、接続の受け付けを比較する
+#   8080: listen 8080;
+#   8081: listen 8081 backlog=1024 deferred fastopen=256;
+# usage: tests/bench_accept.sh [requests] [idle connections]
+N=${1:-200}
+IDLE=${2:-50}
+
+./webserv config/valid/listen_options.conf > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+
+# 新しい接続ごとに、接続完了から応答の先頭バイトまでの時間を測る
+bench() {
+  local url=$1
+  shift
+  local urls=()
+  for ((i = 0; i < N; i++)); do urls+=(-o /dev/null "$url"); done
+  curl -s "$@" -w "%{time_connect} %{time_starttransfer}\n" "${urls[@]}" |
+    awk '{ printf "%.0f\n", ($2 - $1) * 1000000 }' | sort -n |
+    awk -v n="$N" -v label="$LABEL" '{ s += $1; v[NR] = $1 }
+      END { printf "%-22s accept-to-first-byte avg=%6.0f us p50=%6.0f us p99=%6.0f us\n",
+        label, s / n, v[int(n * 0.5)], v[int(n * 0.99)] }'
+}
+
+# 接続だけしてrequestを送らないclientを張り、serverがacceptしたfd数を数える
+idle() {
+  local port=$1
+  python3 -c "
+import socket, time
+s = [socket.create_connection(('localhost', $port)) for _ in range($IDLE)]
+time.sleep(2)" &
+  local client=$!
+  sleep 1
+  local accepted
+  accepted=$(ss -tnH state established "( sport = :$port )" | wc -l)
+  printf "%-22s %d idle connections -> accepted by server: %d\n" "$LABEL" "$IDLE" "$accepted"
+  wait $client
+}
+
+echo "=== Accept benchmark ==="
+if (($(cat /proc/sys/net/ipv4/tcp_fastopen 2> /dev/null || echo 0) & 2)); then
+  echo "tcp_fastopen: server side enabled"
+else
+  echo "tcp_fastopen: server side disabled (sysctl net.ipv4.tcp_fastopen=3 to enable)"
+fi
+LABEL="plain" bench "http://localhost:8080/"
+LABEL="deferred+fastopen" bench "http://localhost:8081/"
+LABEL="deferred+fastopen TFO" bench "http://localhost:8081/" --tcp-fastopen
+LABEL="plain" idle 8080
+LABEL="deferred" idle 8081
+echo "=== Benchmark Completed ==="
+
+kill $SERVER
+wait 2> /dev/null
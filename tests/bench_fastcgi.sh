@@ -0,0 +1,27 @@
+#!/bin/bash
+# fork-per-request CGI と FastCGI (persistent workers) の比較
+# usage: tests/bench_fastcgi.sh [requests]
+N=${1:-200}
+SOCK=/tmp/webserv_fcgi.sock
+
+python3 tests/fastcgi_responder.py "$SOCK" 4 > /dev/null &
+RESPONDER=$!
+./webserv $WEBSERV_FLAGS config/valid/fastcgi.conf > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+
+bench() {
+  local url=$1
+  local urls=()
+  for ((i = 0; i < N; i++)); do urls+=(-o /dev/null "$url"); done
+  curl -s --max-time 10 -w "%{time_total}\n" "${urls[@]}" |
+    awk -v n="$N" -v label="$2" '{ s += $1 } END { printf "%-10s %d requests: %.3f s (%.2f ms/req)\n", label, n, s, s * 1000 / n }'
+}
+
+echo "=== FastCGI vs CGI benchmark ==="
+bench "http://localhost:8080/cgi-bin/hello.py" "CGI"
+bench "http://localhost:8080/fcgi/hello" "FastCGI"
+echo "=== Benchmark Completed ==="
+
+kill $SERVER $RESPONDER
+wait 2> /dev/null
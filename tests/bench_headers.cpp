@@ -0,0 +1,146 @@
+// status行とheaderの組み立てを、ostringstream版とHeaderWriter版で比べる
+// usage: make headerbench
+#include "HeaderWriter.hpp"
+#include "HttpResponse.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+static std::string stream_date() {
+  char buf[100];
+  std::time_t now = std::time(NULL);
+  std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT",
+                std::gmtime(&now));
+  return std::string(buf);
+}
+
+// HeaderWriter 導入前の HttpResponse と同じ組み立て方
+static size_t stream_200(size_t content_length) {
+  std::ostringstream oss;
+  oss << "HTTP/1.1 " << 200 << " OK\r\n";
+  oss << "Content-Length: " << content_length << "\r\n";
+  oss << "Content-Type: " << "text/html" << "\r\n";
+  oss << "Date: " << stream_date() << "\r\n";
+  oss << "Connection: " << "keep-alive" << "\r\n\r\n";
+  std::string str = oss.str();
+  std::vector<char> head(str.begin(), str.end());
+  return head.size();
+}
+
+static size_t stream_304() {
+  std::ostringstream oss;
+  oss << "HTTP/1.1 " << 304 << " "
+      << HttpResponse::get_status_message(304) << "\r\n";
+  oss << "ETag: " << "\"5f3a-1b2c\"" << "\r\n";
+  oss << "Date: " << stream_date() << "\r\n";
+  oss << "Connection: " << "keep-alive" << "\r\n\r\n";
+  std::string str = oss.str();
+  std::vector<char> head(str.begin(), str.end());
+  return head.size();
+}
+
+static size_t stream_404() {
+  const std::string message = HttpResponse::get_status_message(404);
+  std::ostringstream oss;
+  oss << "HTTP/1.1 " << 404 << " " << message << "\r\n";
+  oss << "Content-Length: " << message.size() << "\r\n";
+  oss << "Content-Type: text/plain\r\n";
+  oss << "Date: " << stream_date() << "\r\n";
+  oss << "Connection: " << "close" << "\r\n\r\n";
+  oss << message;
+  std::string str = oss.str();
+  std::vector<char> head(str.begin(), str.end());
+  return head.size();
+}
+
+static size_t writer_200(size_t content_length) {
+  std::vector<char> head;
+  HeaderWriter writer(head);
+  writer.status_line(200);
+  writer.header("Content-Length", content_length);
+  writer.header("Content-Type", "text/html");
+  writer.date_header();
+  writer.connection_header(CP_KEEP_ALIVE);
+  writer.end();
+  return head.size();
+}
+
+static size_t writer_304() {
+  std::vector<char> head;
+  HeaderWriter writer(head);
+  writer.status_line(304);
+  writer.header("ETag", "\"5f3a-1b2c\"");
+  writer.date_header();
+  writer.connection_header(CP_KEEP_ALIVE);
+  writer.end();
+  return head.size();
+}
+
+static size_t writer_404() {
+  const char *message = HttpResponse::get_status_message(404);
+  std::vector<char> head;
+  HeaderWriter writer(head);
+  writer.status_line(404);
+  writer.header("Content-Length", std::strlen(message));
+  writer.header("Content-Type", "text/plain");
+  writer.date_header();
+  writer.connection_header(CP_MUST_CLOSE);
+  writer.end();
+  writer.append(message);
+  writer.flush();
+  return head.size();
+}
+
+static double now_sec() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+enum Case { CASE_200, CASE_304, CASE_404 };
+
+static size_t run(bool use_writer, Case c, long iterations) {
+  size_t total = 0;
+  for (long i = 0; i < iterations; ++i) {
+    switch (c) {
+    case CASE_200:
+      total += use_writer ? writer_200(1048576 + i) : stream_200(1048576 + i);
+      break;
+    case CASE_304:
+      total += use_writer ? writer_304() : stream_304();
+      break;
+    case CASE_404:
+      total += use_writer ? writer_404() : stream_404();
+      break;
+    }
+  }
+  return total;
+}
+
+int main(int argc, char **argv) {
+  long iterations = (argc > 1) ? std::atol(argv[1]) : 200000;
+  const char *labels[] = {"200 OK", "304", "404"};
+  const Case cases[] = {CASE_200, CASE_304, CASE_404};
+
+  std::printf("=== Header serialization (%ld iterations) ===\n", iterations);
+  for (size_t i = 0; i < 3; ++i) {
+    double start = now_sec();
+    size_t stream_bytes = run(false, cases[i], iterations);
+    double stream_ns = (now_sec() - start) * 1e9 / iterations;
+
+    start = now_sec();
+    size_t writer_bytes = run(true, cases[i], iterations);
+    double writer_ns = (now_sec() - start) * 1e9 / iterations;
+
+    std::printf("%-7s ostringstream %7.0f ns  HeaderWriter %7.0f ns  (x%.1f)%s\n",
+                labels[i], stream_ns, writer_ns, stream_ns / writer_ns,
+                stream_bytes == writer_bytes ? "" : "  size mismatch!");
+  }
+  std::printf("=== Benchmark Completed ===\n");
+  return 0;
+}
@@ -0,0 +1,49 @@
+#!/bin/bash
+# I/O多重化の実装 (webserv -e <backend>) ごとに、keep-alive の負荷をかけて比較する
+# usage: tests/bench_multiplexer.sh [seconds] [connections...]
+# 例: tests/bench_multiplexer.sh 5 1000 10000 50000
+# - fd数の上限 (ulimit -Hn) や ephemeral port を超える接続は張れないので、
+#   実際に張れた数を conns に出す
+# - select は FD_SETSIZE (1024) 以上のfdを扱えないので、1000接続を超えると省く
+SECONDS_PER_RUN=${1:-5}
+shift
+CONNECTIONS=${*:-1000 10000 50000}
+BACKENDS=(epoll io_uring poll select)
+SELECT_MAX_CONNECTIONS=1000
+LOADGEN=/tmp/webserv_loadgen
+
+cc -O2 -o "$LOADGEN" tests/loadgen.c || exit 1
+ulimit -n "$(ulimit -Hn)"
+
+# /proc/<pid>/stat の utime + stime (clock tick)
+cpu_ticks() {
+  awk '{ print $14 + $15 }' "/proc/$1/stat"
+}
+
+echo "=== Multiplexer benchmark (${SECONDS_PER_RUN}s per run, $(nproc) CPU) ==="
+printf "%-9s %6s %6s %9s %8s %8s %8s %7s\n" \
+  backend target conns req/s p50_us p99_us errors cpu%
+for backend in "${BACKENDS[@]}"; do
+  for target in $CONNECTIONS; do
+    if [ "$backend" = select ] && ((target > SELECT_MAX_CONNECTIONS)); then
+      printf "%-9s %6d %6s (skipped: FD_SETSIZE)\n" "$backend" "$target" -
+      continue
+    fi
+    ./webserv -e "$backend" config/valid/server.conf > /dev/null 2>&1 &
+    SERVER=$!
+    sleep 1
+    before=$(cpu_ticks $SERVER)
+    start=$(date +%s%N)
+    result=$("$LOADGEN" 8080 /index1.html "$target" "$SECONDS_PER_RUN")
+    after=$(cpu_ticks $SERVER)
+    elapsed_ms=$((($(date +%s%N) - start) / 1000000))
+    kill $SERVER
+    wait $SERVER 2> /dev/null
+    eval "$(echo "$result" | tr ' ' '\n' | grep '=')"
+    # 接続を張る時間も含めた、loadgenの実行時間あたりのCPU使用率
+    cpu=$(((after - before) * 100000 / $(getconf CLK_TCK) / elapsed_ms))
+    printf "%-9s %6d %6d %9d %8d %8d %8d %6d%%\n" "$backend" "$target" \
+      "$connected" "$rps" "$p50_us" "$p99_us" "$errors" "$cpu"
+  done
+done
+echo "=== Benchmark Completed ==="
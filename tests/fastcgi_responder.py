@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Minimal FastCGI responder for local testing and benchmarks.
+
+usage: tests/fastcgi_responder.py [socket_path] [workers]
+
+Pre-forks worker processes that accept on a UNIX socket and keep the
+connection open when the server sets FCGI_KEEP_CONN.
+"""
+import os
+import signal
+import socket
+import struct
+import sys
+
+FCGI_BEGIN_REQUEST = 1
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+FCGI_KEEP_CONN = 1
+
+
+def recv_exact(conn, n):
+    data = b""
+    while len(data) < n:
+        chunk = conn.recv(n - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def read_record(conn):
+    header = recv_exact(conn, 8)
+    if header is None:
+        return None
+    _, rtype, req_id, clen, plen, _ = struct.unpack("!BBHHBB", header)
+    content = recv_exact(conn, clen + plen)
+    if content is None:
+        return None
+    return rtype, req_id, content[:clen]
+
+
+def write_record(conn, rtype, req_id, content):
+    for off in range(0, max(len(content), 1), 65535):
+        part = content[off:off + 65535]
+        pad = (8 - len(part) % 8) % 8
+        conn.sendall(struct.pack("!BBHHBB", 1, rtype, req_id, len(part), pad, 0)
+                     + part + b"\0" * pad)
+
+
+def decode_params(data):
+    params, i = {}, 0
+    while i < len(data):
+        lens = []
+        for _ in range(2):
+            if data[i] < 128:
+                lens.append(data[i])
+                i += 1
+            else:
+                lens.append(struct.unpack("!I", data[i:i + 4])[0] & 0x7fffffff)
+                i += 4
+        name = data[i:i + lens[0]].decode("latin-1")
+        i += lens[0]
+        params[name] = data[i:i + lens[1]].decode("latin-1")
+        i += lens[1]
+    return params
+
+
+def respond(params, body):
+    text = "Hello from FastCGI pid %d\nmethod=%s script=%s query=%s body=%d\n" % (
+        os.getpid(), params.get("REQUEST_METHOD", ""),
+        params.get("SCRIPT_NAME", ""), params.get("QUERY_STRING", ""), len(body))
+    payload = text.encode()
+    return (b"Content-Type: text/plain\r\nContent-Length: %d\r\n\r\n"
+            % len(payload)) + payload
+
+
+def serve(conn):
+    while True:
+        params_data, body, keep_conn, req_id = b"", b"", False, 1
+        while True:
+            rec = read_record(conn)
+            if rec is None:
+                return
+            rtype, req_id, content = rec
+            if rtype == FCGI_BEGIN_REQUEST:
+                keep_conn = bool(content[2] & FCGI_KEEP_CONN)
+            elif rtype == FCGI_PARAMS:
+                params_data += content
+            elif rtype == FCGI_STDIN:
+                if not content:
+                    break
+                body += content
+        out = respond(decode_params(params_data), body)
+        write_record(conn, FCGI_STDOUT, req_id, out)
+        write_record(conn, FCGI_STDOUT, req_id, b"")
+        write_record(conn, FCGI_END_REQUEST, req_id, struct.pack("!IB3x", 0, 0))
+        if not keep_conn:
+            return
+
+
+def worker(sock):
+    signal.signal(signal.SIGINT, signal.SIG_DFL)
+    while True:
+        conn, _ = sock.accept()
+        try:
+            serve(conn)
+        except (ConnectionError, OSError):
+            pass
+        finally:
+            conn.close()
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else "/tmp/webserv_fcgi.sock"
+    workers = int(sys.argv[2]) if len(sys.argv) > 2 else 4
+    if os.path.exists(path):
+        os.unlink(path)
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.bind(path)
+    sock.listen(128)
+    children = []
+    for _ in range(workers):
+        pid = os.fork()
+        if pid == 0:
+            worker(sock)
+            os._exit(0)
+        children.append(pid)
+    signal.signal(signal.SIGTERM, lambda *_: sys.exit(0))
+    print("FastCGI responder listening on %s (%d workers)" % (path, workers))
+    try:
+        for pid in children:
+            os.waitpid(pid, 0)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        for pid in children:
+            try:
+                os.kill(pid, signal.SIGTERM)
+            except ProcessLookupError:
+                pass
+        os.unlink(path)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,178 @@
+/*
+ * keep-alive の接続を張り続けて GET を繰り返す負荷生成器 (epoll, 1 thread)
+ * usage: loadgen <port> <path> <connections> <seconds>
+ * 出力: "connected=N requests=N errors=N rps=N p50_us=N p99_us=N"
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+  int fd;
+  char buf[4096]; // index1.html (約2KB) の応答が収まる大きさ
+  size_t len;
+  long long sent_at; // 応答待ちでなければ 0
+} conn_t;
+
+static struct sockaddr_in g_addr;
+static char g_request[512];
+static size_t g_request_len;
+static int g_epfd;
+
+static long long g_requests;
+static long long g_errors;
+static unsigned *g_latencies; // us
+static size_t g_latency_count;
+static size_t g_latency_cap;
+
+static long long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void record_latency(long long us) {
+  if (g_latency_count == g_latency_cap) {
+    g_latency_cap = g_latency_cap ? g_latency_cap * 2 : 65536;
+    g_latencies = realloc(g_latencies, g_latency_cap * sizeof(unsigned));
+  }
+  g_latencies[g_latency_count++] = (unsigned)us;
+}
+
+static int send_request(conn_t *c) {
+  c->len = 0;
+  c->sent_at = now_us();
+  return send(c->fd, g_request, g_request_len, MSG_NOSIGNAL) ==
+                 (ssize_t)g_request_len
+             ? 0
+             : -1;
+}
+
+static int open_conn(conn_t *c) {
+  c->fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (c->fd == -1)
+    return -1;
+  int one = 1;
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(c->fd, (struct sockaddr *)&g_addr, sizeof(g_addr)) == -1) {
+    close(c->fd);
+    c->fd = -1;
+    return -1;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = c;
+  epoll_ctl(g_epfd, EPOLL_CTL_ADD, c->fd, &ev);
+  return 0;
+}
+
+static void reopen_conn(conn_t *c) {
+  ++g_errors;
+  if (c->fd != -1)
+    close(c->fd);
+  c->sent_at = 0;
+  if (open_conn(c) == 0)
+    send_request(c);
+}
+
+// ヘッダ終端とContent-Lengthから、応答を読み終えたかを判定する
+static int response_complete(conn_t *c) {
+  c->buf[c->len] = '\0';
+  char *end = strstr(c->buf, "\r\n\r\n");
+  if (!end)
+    return 0;
+  size_t body = 0;
+  char *cl = strcasestr(c->buf, "\r\ncontent-length:");
+  if (cl && cl < end)
+    body = strtoul(cl + 17, NULL, 10);
+  return c->len >= (size_t)(end + 4 - c->buf) + body;
+}
+
+static int cmp_unsigned(const void *a, const void *b) {
+  unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+  return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 5) {
+    fprintf(stderr, "usage: %s <port> <path> <connections> <seconds>\n",
+            argv[0]);
+    return 1;
+  }
+  int port = atoi(argv[1]);
+  int nconn = atoi(argv[3]);
+  int seconds = atoi(argv[4]);
+
+  struct rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+
+  memset(&g_addr, 0, sizeof(g_addr));
+  g_addr.sin_family = AF_INET;
+  g_addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &g_addr.sin_addr);
+  g_request_len = snprintf(g_request, sizeof(g_request),
+                           "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                           argv[2]);
+  g_epfd = epoll_create1(0);
+
+  conn_t *conns = calloc(nconn, sizeof(conn_t));
+  int opened = 0;
+  for (int i = 0; i < nconn; ++i) {
+    if (open_conn(&conns[i]) == 0)
+      ++opened;
+  }
+  for (int i = 0; i < nconn; ++i) {
+    if (conns[i].fd != -1 && send_request(&conns[i]) == -1)
+      reopen_conn(&conns[i]);
+  }
+
+  struct epoll_event events[1024];
+  long long start = now_us();
+  long long deadline = start + (long long)seconds * 1000000;
+  while (now_us() < deadline) {
+    int n = epoll_wait(g_epfd, events, 1024, 100);
+    for (int i = 0; i < n; ++i) {
+      conn_t *c = events[i].data.ptr;
+      ssize_t r = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+      if (r <= 0) {
+        if (r == -1 && errno == EAGAIN)
+          continue;
+        reopen_conn(c);
+        continue;
+      }
+      c->len += r;
+      if (c->len >= sizeof(c->buf) - 1) {
+        reopen_conn(c); // 応答が大きすぎる: 静的な小さいfile向け
+        continue;
+      }
+      if (!response_complete(c))
+        continue;
+      long long t = now_us();
+      ++g_requests;
+      record_latency(t - c->sent_at);
+      if (send_request(c) == -1)
+        reopen_conn(c);
+    }
+  }
+  double elapsed = (now_us() - start) / 1e6;
+
+  qsort(g_latencies, g_latency_count, sizeof(unsigned), cmp_unsigned);
+  unsigned p50 = g_latency_count ? g_latencies[g_latency_count / 2] : 0;
+  unsigned p99 = g_latency_count ? g_latencies[g_latency_count * 99 / 100] : 0;
+  printf("connected=%d requests=%lld errors=%lld rps=%.0f p50_us=%u "
+         "p99_us=%u\n",
+         opened, g_requests, g_errors, g_requests / elapsed, p50, p99);
+  return 0;
+}
@@ -0,0 +1,65 @@
+#!/bin/bash
+# 1 requestあたりの malloc回数と memcpy/memmove のコピー量を測る
+# usage: tests/measure_allocs.sh [requests]
+N=${1:-100}
+SHIM=/tmp/webserv_alloc_counter.so
+STATS=/tmp/webserv_alloc_stats.log
+BODY=public/_alloc_body.bin
+
+cc -shared -fPIC -O2 -o "$SHIM" tests/alloc_counter.c -ldl || exit 1
+head -c 1048576 /dev/zero > "$BODY"
+trap 'rm -f "$BODY"' EXIT
+
+LD_PRELOAD=$SHIM ./webserv config/valid/server.conf 2> "$STATS" > /dev/null &
+SERVER=$!
+sleep 1
+
+snapshot() {
+  kill -USR2 $SERVER
+  sleep 0.2
+  tail -n 1 "$STATS"
+}
+
+measure() {
+  local url=$1
+  local urls=()
+  for ((i = 0; i < N; i++)); do urls+=(-o /dev/null "$url"); done
+  curl -s "$url" -o /dev/null # warm up
+  local before after
+  before=$(snapshot)
+  curl -s "${urls[@]}"
+  sleep 0.5
+  after=$(snapshot)
+  echo "$before" "$after" | awk -v n="$N" -v label="$2" '{
+    for (i = 1; i <= 4; i++) { split($i, b, "="); split($(i + 4), a, "="); d[i] = (a[2] - b[2]) / n }
+    printf "%-14s allocs/req=%8.1f alloc_bytes/req=%10.0f copies/req=%8.1f copy_bytes/req=%10.0f\n",
+      label, d[1], d[2], d[3], d[4] }'
+}
+
+# 1 requestごとに新しい接続を張る (Client の生成・破棄を含めて測る)
+measure_connections() {
+  local url=$1
+  curl -s "$url" -o /dev/null # warm up
+  local before after
+  before=$(snapshot)
+  for ((i = 0; i < N; i++)); do curl -s -o /dev/null "$url"; done
+  sleep 0.5
+  after=$(snapshot)
+  echo "$before" "$after" | awk -v n="$N" -v label="$2" '{
+    for (i = 1; i <= 4; i++) { split($i, b, "="); split($(i + 4), a, "="); d[i] = (a[2] - b[2]) / n }
+    printf "%-14s allocs/req=%8.1f alloc_bytes/req=%10.0f copies/req=%8.1f copy_bytes/req=%10.0f\n",
+      label, d[1], d[2], d[3], d[4] }'
+}
+
+echo "=== Allocation / copy count per request ==="
+measure "http://localhost:8080/" "static small"
+measure "http://localhost:8080/_alloc_body.bin" "static 1MiB"
+measure "http://localhost:8080/cgi-bin/hello.py" "CGI"
+measure "http://localhost:8080/_no_such_page" "404 page"
+measure "http://localhost:8080/menu" "301 redirect"
+measure_connections "http://localhost:8080/" "new conn"
+measure_connections "http://localhost:8080/cgi-bin/hello.py" "new conn CGI"
+echo "=== Measurement Completed ==="
+
+kill $SERVER
+wait 2> /dev/null